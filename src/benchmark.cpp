@@ -19,11 +19,19 @@
 #include "benchmark.h"
 #include "numa.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <type_traits>
 #include <vector>
 
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "tt.h"
+
 namespace {
 
 // clang-format off
@@ -509,4 +517,124 @@ BenchmarkSetup setup_benchmark(std::istream& is) {
     return setup;
 }
 
-}  // namespace Stockfish
\ No newline at end of file
+
+namespace {
+
+struct TTLayoutStats {
+    uint64_t nodes = 0, hits = 0, collisions = 0;
+};
+
+// Walks the tree of legal moves down to the given depth, probing and writing the table at
+// every node. As in a search, a hit with enough depth cuts off the subtree, so a layout that
+// keeps more useful entries walks fewer nodes. The value and eval of an entry hold 32 more
+// bits of the key, which tell whether a hit belongs to the probed position or is a collision.
+template<typename Layout>
+void tt_walk(Position&                        pos,
+             BasicTranspositionTable<Layout>& tt,
+             Depth                            depth,
+             TTLayoutStats&                   stats) {
+
+    const Key   key       = pos.key();
+    const Value check     = Value(int16_t(key >> 48));
+    const Value checkEval = Value(int16_t(key >> 32));
+
+    auto [ttHit, ttData, ttWriter] = tt.probe(key);
+    stats.nodes++;
+
+    if (ttHit)
+    {
+        stats.hits++;
+        stats.collisions += ttData.value != check || ttData.eval != checkEval;
+
+        if (ttData.depth >= depth)
+            return;
+    }
+
+    ttWriter.write(key, check, false, BOUND_EXACT, depth, Move::none(), checkEval,
+                   tt.generation());
+
+    if (depth <= 0)
+        return;
+
+    StateInfo st;
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+    {
+        pos.do_move(m, st);
+        tt_walk(pos, tt, depth - 1, stats);
+        pos.undo_move(m);
+    }
+}
+
+template<typename Layout>
+void tt_layout(const std::vector<std::string>& fens,
+               size_t                          mbSize,
+               Depth                           depth,
+               ThreadPool&                     threads) {
+
+    BasicTranspositionTable<Layout> tt;
+    TTLayoutStats                   stats;
+
+    tt.resize(mbSize, threads);
+
+    TimePoint elapsed = now();
+
+    for (const auto& fen : fens)
+    {
+        StateInfo st;
+        Position  pos;
+
+        pos.set(fen, false, &st);
+        tt.new_search();
+        tt_walk(pos, tt, depth, stats);
+    }
+
+    elapsed = now() - elapsed + 1;  // Ensure positivity to avoid a 'divide by zero'
+
+    std::cerr << "\n==========================="
+              << "\nTT layout                  : " << Layout::Name
+              << (std::is_same_v<Layout, TTLayout> ? " (used by the search)" : "")
+              << "\nEntries per cluster        : " << Layout::ClusterSize
+              << "\nCluster size [bytes]       : " << Layout::ClusterBytes
+              << "\nKey bits per entry         : " << 8 * sizeof(typename Layout::KeyType)
+              << "\nNodes walked               : " << stats.nodes
+              << "\nHit rate [%]               : " << 100.0 * stats.hits / stats.nodes
+              << "\nCollision rate [% of hits] : "
+              << 100.0 * stats.collisions / std::max<uint64_t>(stats.hits, 1)
+              << "\nNodes/second               : " << 1000 * stats.nodes / elapsed << std::endl;
+}
+
+}  // namespace
+
+
+// Returns the FENs of the default bench positions, without the Chess960 ones
+std::vector<std::string> default_fens() {
+
+    std::vector<std::string> fens;
+
+    for (const auto& line : Defaults)
+    {
+        // Skip the Chess960 positions at the end of the list
+        if (line == "setoption name UCI_Chess960 value true")
+            break;
+
+        if (line.find("setoption") == std::string::npos)
+            fens.push_back(line.substr(0, line.find(" moves")));
+    }
+
+    return fens;
+}
+
+// Compares the TT layouts on the default bench positions, each with a table of the given size.
+// The search only uses the layout it was compiled with, see `make help`, so the nodes per
+// second here measure the table in isolation, with move generation as the only other cost.
+void tt_layouts(size_t mbSize, Depth depth, ThreadPool& threads) {
+
+    const std::vector<std::string> fens = default_fens();
+
+    tt_layout<TTLayoutCompact>(fens, mbSize, depth, threads);
+    tt_layout<TTLayoutCacheLine>(fens, mbSize, depth, threads);
+    tt_layout<TTLayoutLongKey>(fens, mbSize, depth, threads);
+}
+
+}  // namespace Stockfish
@@ -19,10 +19,17 @@
 #ifndef BENCHMARK_H_INCLUDED
 #define BENCHMARK_H_INCLUDED
 
+#include <cstddef>
 #include <iosfwd>
 #include <string>
 #include <vector>
 
+#include "types.h"
+
+namespace Stockfish {
+class ThreadPool;
+}
+
 namespace Stockfish::Benchmark {
 
 std::vector<std::string> setup_bench(const std::string&, std::istream&);
@@ -37,6 +44,10 @@ struct BenchmarkSetup {
 
 BenchmarkSetup setup_benchmark(std::istream&);
 
+std::vector<std::string> default_fens();
+
+void tt_layouts(size_t mbSize, Depth depth, ThreadPool& threads);
+
 }  // namespace Stockfish
 
 #endif  // #ifndef BENCHMARK_H_INCLUDED
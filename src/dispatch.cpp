@@ -0,0 +1,162 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2025 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// The entry point of a fat binary, built with `make fat-build`. Such a binary links a build
+// of the engine for each of several x86-64 architectures, each one compiled in its own
+// namespace, and runs the best one the CPU supports. Every build is a complete engine, so
+// that PEXT attacks and the movegen and NNUE code paths of each level are all available.
+//
+// The static initializers of a build may use its instruction set, so they must not run
+// before the build is chosen. `make fat-build` moves them out of .init_array to a section
+// of their own, fat_init_<namespace>, which is run here just before the engine starts.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "evaluate.h"
+
+#define INCBIN_SILENCE_BITCODE_WARNING
+#include "incbin/incbin.h"
+
+// The networks are embedded once for all the builds
+#if !defined(NNUE_EMBEDDING_OFF)
+INCBIN(EmbeddedNNUEBig, EvalFileDefaultNameBig);
+INCBIN(EmbeddedNNUESmall, EvalFileDefaultNameSmall);
+#endif
+
+namespace {
+
+using InitFunction = void (*)();
+
+// The features of the CPU needed by each architecture, as set in the Makefile
+struct CpuFeatures {
+    bool baseline, sse41Popcnt, avx2, bmi2, avx512, vnni512, avx512icl;
+
+    CpuFeatures() {
+        __builtin_cpu_init();
+
+        baseline    = true;
+        sse41Popcnt = __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt");
+
+        avx2 = sse41Popcnt && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi");
+
+        // PEXT is microcoded, and much slower than the magic bitboards, before Zen 3
+        bmi2 = avx2 && __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver1")
+            && !__builtin_cpu_is("znver2");
+
+        avx512 = bmi2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+              && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+
+        vnni512 = avx512 && __builtin_cpu_supports("avx512vnni");
+
+        avx512icl = vnni512 && __builtin_cpu_supports("avx512cd")
+                 && __builtin_cpu_supports("avx512ifma") && __builtin_cpu_supports("avx512vbmi")
+                 && __builtin_cpu_supports("avx512vbmi2")
+                 && __builtin_cpu_supports("avx512vpopcntdq")
+                 && __builtin_cpu_supports("avx512bitalg") && __builtin_cpu_supports("vpclmulqdq")
+                 && __builtin_cpu_supports("gfni") && __builtin_cpu_supports("vaes");
+    }
+};
+
+// Runs the static initializers of the chosen build, then the engine
+int start(const InitFunction* initBegin,
+          const InitFunction* initEnd,
+          int (*run)(int, char*[]),
+          int   argc,
+          char* argv[]) {
+
+    for (const InitFunction* f = initBegin; f != initEnd; ++f)
+        (*f)();
+
+    return run(argc, argv);
+}
+
+}  // namespace
+
+// For each build compiled in, FAT_VARIANT_<arch> is defined by the Makefile. The linker
+// defines the bounds of its section of initializers, the declarations are weak in case
+// a build has none.
+#define DECLARE_VARIANT(NS) \
+    namespace NS { \
+    int run(int argc, char* argv[]); \
+    } \
+    extern "C" __attribute__((weak)) const InitFunction __start_fat_init_##NS[]; \
+    extern "C" __attribute__((weak)) const InitFunction __stop_fat_init_##NS[];
+
+// Runs the build if the CPU supports it, and if no other build is forced through the
+// STOCKFISH_ARCH environment variable
+#define RUN_VARIANT(NS, ARCH, FEATURE) \
+    if (cpu.FEATURE && (!forced || !std::strcmp(forced, ARCH))) \
+        return start(__start_fat_init_##NS, __stop_fat_init_##NS, NS::run, argc, argv);
+
+#ifdef FAT_VARIANT_x86_64_avx512icl
+DECLARE_VARIANT(Stockfish_x86_64_avx512icl)
+#endif
+#ifdef FAT_VARIANT_x86_64_vnni512
+DECLARE_VARIANT(Stockfish_x86_64_vnni512)
+#endif
+#ifdef FAT_VARIANT_x86_64_avx512
+DECLARE_VARIANT(Stockfish_x86_64_avx512)
+#endif
+#ifdef FAT_VARIANT_x86_64_bmi2
+DECLARE_VARIANT(Stockfish_x86_64_bmi2)
+#endif
+#ifdef FAT_VARIANT_x86_64_avx2
+DECLARE_VARIANT(Stockfish_x86_64_avx2)
+#endif
+#ifdef FAT_VARIANT_x86_64_sse41_popcnt
+DECLARE_VARIANT(Stockfish_x86_64_sse41_popcnt)
+#endif
+#ifdef FAT_VARIANT_x86_64
+DECLARE_VARIANT(Stockfish_x86_64)
+#endif
+
+int main(int argc, char* argv[]) {
+
+    const CpuFeatures cpu;
+    const char*       env    = std::getenv("STOCKFISH_ARCH");
+    const char*       forced = env && *env ? env : nullptr;
+
+#ifdef FAT_VARIANT_x86_64_avx512icl
+    RUN_VARIANT(Stockfish_x86_64_avx512icl, "x86-64-avx512icl", avx512icl)
+#endif
+#ifdef FAT_VARIANT_x86_64_vnni512
+    RUN_VARIANT(Stockfish_x86_64_vnni512, "x86-64-vnni512", vnni512)
+#endif
+#ifdef FAT_VARIANT_x86_64_avx512
+    RUN_VARIANT(Stockfish_x86_64_avx512, "x86-64-avx512", avx512)
+#endif
+#ifdef FAT_VARIANT_x86_64_bmi2
+    RUN_VARIANT(Stockfish_x86_64_bmi2, "x86-64-bmi2", bmi2)
+#endif
+#ifdef FAT_VARIANT_x86_64_avx2
+    RUN_VARIANT(Stockfish_x86_64_avx2, "x86-64-avx2", avx2)
+#endif
+#ifdef FAT_VARIANT_x86_64_sse41_popcnt
+    RUN_VARIANT(Stockfish_x86_64_sse41_popcnt, "x86-64-sse41-popcnt", sse41Popcnt)
+#endif
+#ifdef FAT_VARIANT_x86_64
+    RUN_VARIANT(Stockfish_x86_64, "x86-64", baseline)
+#endif
+
+    std::fprintf(stderr, "No build in this binary supports this CPU%s%s\n",
+                 forced ? " as " : "", forced ? forced : "");
+    return EXIT_FAILURE;
+}
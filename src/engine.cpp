@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <deque>
 #include <iosfwd>
 #include <memory>
@@ -29,6 +30,7 @@
 #include <utility>
 #include <vector>
 
+#include "benchmark.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "nnue/network.h"
@@ -59,7 +61,8 @@ Engine::Engine(std::optional<std::string> path) :
       numaContext,
       NN::Networks(
         NN::NetworkBig({EvalFileDefaultNameBig, "None", ""}, NN::EmbeddedNNUEType::BIG),
-        NN::NetworkSmall({EvalFileDefaultNameSmall, "None", ""}, NN::EmbeddedNNUEType::SMALL))) {
+        NN::NetworkSmall({EvalFileDefaultNameSmall, "None", ""}, NN::EmbeddedNNUEType::SMALL))),
+    sharedHistories(numaContext) {
     pos.set(StartFEN, false, &states->back());
 
 
@@ -82,10 +85,40 @@ Engine::Engine(std::optional<std::string> path) :
           return thread_allocation_information_as_string();
       }));
 
+    options.add("DeferBusyMoves", Option(false));
+
+    options.add("DeterministicSearch", Option(false));
+
+    options.add(  //
+      "SharedHistories", Option(false, [this](const Option& o) {
+          wait_for_search_finished();
+          sharedHistories = SharedHistories(bool(o));
+          return std::nullopt;
+      }));
+
     options.add(  //
       "Hash", Option(16, 1, MaxHashMB, [this](const Option& o) {
           set_tt_size(o);
-          return std::nullopt;
+          return std::optional<std::string>("Page sizes: " + page_size_information_as_string());
+      }));
+
+    options.add(  //
+      "SharedHash", Option("", [this](const Option& o) {
+          set_tt_size(options["Hash"]);
+          if (std::string(o).empty())
+              return std::optional<std::string>{};
+          return std::optional<std::string>(
+            tt.is_shared() ? "Using shared hash " + std::string(o)
+                           : "Failed to attach shared hash " + std::string(o)
+                               + ", using a private hash");
+      }));
+
+    options.add(  //
+      "HashPlacement", Option("auto", [this](const Option& o) {
+          set_tt_size(options["Hash"]);
+          if (std::string(o) != "interleave")
+              return std::optional<std::string>{};
+          return std::optional<std::string>(hash_placement_information_as_string());
       }));
 
     options.add(  //
@@ -94,12 +127,17 @@ Engine::Engine(std::optional<std::string> path) :
           return std::nullopt;
       }));
 
+    options.add(  //
+      "LazyHashClear", Option(false));
+
     options.add(  //
       "Ponder", Option(false));
 
     options.add(  //
       "MultiPV", Option(1, 1, MAX_MOVES));
 
+    options.add("SplitMultiPV", Option(false));
+
     options.add("Skill Level", Option(20, 0, 20));
 
     options.add("Move Overhead", Option(10, 0, 5000));
@@ -128,6 +166,17 @@ Engine::Engine(std::optional<std::string> path) :
 
     options.add("SyzygyProbeLimit", Option(7, 0, 7));
 
+    options.add("HotSwapNetworks", Option(false));
+
+    options.add(  //
+      "SmallNetOnly", Option(false, [this](const Option&) {
+          wait_for_search_finished();
+          threads.clear_network_caches();
+          return std::nullopt;
+      }));
+
+    options.add("EvalCache", Option(false));
+
     options.add(  //
       "EvalFile", Option(EvalFileDefaultNameBig, [this](const Option& o) {
           load_big_network(o);
@@ -144,14 +193,36 @@ Engine::Engine(std::optional<std::string> path) :
     resize_threads();
 }
 
+Engine::~Engine() {
+    wait_for_search_finished();
+
+    if (loadedNetworks.valid())
+        loadedNetworks.wait();
+}
+
 std::uint64_t Engine::perft(const std::string& fen, Depth depth, bool isChess960) {
     verify_networks();
 
     return Benchmark::perft(fen, depth, isChess960);
 }
 
+void Engine::benchmark_tt_layouts(size_t mbSize, Depth depth) {
+    wait_for_search_finished();
+    Benchmark::tt_layouts(mbSize, depth, threads);
+}
+
+void Engine::benchmark_nnue(int repetitions) {
+    wait_for_search_finished();
+    verify_networks();
+
+    sync_cout << "\n"
+              << Eval::NNUE::benchmark(Benchmark::default_fens(), *networks, repetitions)
+              << sync_endl;
+}
+
 void Engine::go(Search::LimitsType& limits) {
     assert(limits.perft == 0);
+    install_loaded_networks(false);
     verify_networks();
 
     threads.start_thinking(options, pos, states, limits);
@@ -161,7 +232,10 @@ void Engine::stop() { threads.stop = true; }
 void Engine::search_clear() {
     wait_for_search_finished();
 
-    tt.clear(threads);
+    if (options["LazyHashClear"])
+        tt.lazy_clear();
+    else
+        tt.clear(threads);
     threads.clear();
 
     // @TODO wont work with multiple instances
@@ -210,6 +284,9 @@ void Engine::set_position(const std::string& fen, const std::vector<std::string>
 // modifiers
 
 void Engine::set_numa_config_from_option(const std::string& o) {
+    // Networks replicated for the current config must be installed before it changes
+    install_loaded_networks(true);
+
     if (o == "auto" || o == "system")
     {
         numaContext.set_numa_config(NumaConfig::from_system());
@@ -235,16 +312,31 @@ void Engine::set_numa_config_from_option(const std::string& o) {
 
 void Engine::resize_threads() {
     threads.wait_for_search_finished();
-    threads.set(numaContext.get_numa_config(), {options, threads, tt, networks}, updateContext);
+    threads.set(numaContext.get_numa_config(),
+                {options, threads, tt, searchingTable, networks, sharedHistories}, updateContext);
 
-    // Reallocate the hash with the new threadpool size
+    // Adapt the hash to the new threadpool size. Its contents are kept only when the
+    // Hash option changes, new threads start from an empty table.
     set_tt_size(options["Hash"]);
+    tt.clear(threads);
     threads.ensure_network_replicated();
 }
 
 void Engine::set_tt_size(size_t mb) {
     wait_for_search_finished();
-    tt.resize(mb, threads);
+    tt.resize(mb, threads, options["SharedHash"],
+              std::string(options["HashPlacement"]) == "interleave" ? TTPlacement::Interleave
+                                                                    : TTPlacement::Auto);
+}
+
+bool Engine::save_hash(const std::string& file) {
+    wait_for_search_finished();
+    return tt.save(file);
+}
+
+bool Engine::load_hash(const std::string& file) {
+    wait_for_search_finished();
+    return tt.load(file, threads);
 }
 
 void Engine::set_ponderhit(bool b) { threads.main_manager()->ponder = b; }
@@ -252,40 +344,124 @@ void Engine::set_ponderhit(bool b) { threads.main_manager()->ponder = b; }
 // network related
 
 void Engine::verify_networks() const {
+    // Networks loading in the background are verified when installed, until then
+    // the current ones, verified before, keep serving the searches. So do they
+    // after a failed load, until the EvalFile options name loadable files again.
+    if (loadedNetworks.valid() || networkSwapFailed)
+        return;
+
     networks->big.verify(options["EvalFile"], onVerifyNetworks);
     networks->small.verify(options["EvalFileSmall"], onVerifyNetworks);
 }
 
 void Engine::load_networks() {
+    install_loaded_networks(true);
     networks.modify_and_replicate([this](NN::Networks& networks_) {
         networks_.big.load(binaryDirectory, options["EvalFile"]);
         networks_.small.load(binaryDirectory, options["EvalFileSmall"]);
     });
+    networkSwapFailed = false;
     threads.clear();
     threads.ensure_network_replicated();
 }
 
 void Engine::load_big_network(const std::string& file) {
+    if (options["HotSwapNetworks"])
+        return load_networks_in_background();
+
+    install_loaded_networks(true);
     networks.modify_and_replicate(
       [this, &file](NN::Networks& networks_) { networks_.big.load(binaryDirectory, file); });
+    networkSwapFailed = false;
     threads.clear();
     threads.ensure_network_replicated();
 }
 
 void Engine::load_small_network(const std::string& file) {
+    if (options["HotSwapNetworks"])
+        return load_networks_in_background();
+
+    install_loaded_networks(true);
     networks.modify_and_replicate(
       [this, &file](NN::Networks& networks_) { networks_.small.load(binaryDirectory, file); });
+    networkSwapFailed = false;
     threads.clear();
     threads.ensure_network_replicated();
 }
 
+// Loads the networks of the EvalFile options on a thread of its own, into a copy of the
+// current ones, which keep serving the searches meanwhile. The copy is then replicated to
+// the NUMA nodes, and replaces the current networks at the start of the next search. A
+// new load supersedes one that has not been installed yet, as it loads both files.
+void Engine::load_networks_in_background() {
+    if (loadedNetworks.valid())
+        loadedNetworks.wait();
+
+    const std::string bigFile   = options["EvalFile"];
+    const std::string smallFile = options["EvalFileSmall"];
+
+    loadedNetworks = std::async(std::launch::async, [this, bigFile, smallFile,
+                                                     report = onVerifyNetworks]() {
+        NN::Networks loaded = *networks;
+
+        loaded.big.load(binaryDirectory, bigFile);
+        loaded.small.load(binaryDirectory, smallFile);
+
+        // Unlike a load between searches, a file that could not be loaded doesn't
+        // terminate the engine, the current networks stay in use.
+        if (!loaded.big.is_loaded(bigFile) || !loaded.small.is_loaded(smallFile))
+        {
+            if (report)
+                report("Failed to load NNUE networks " + bigFile + " and " + smallFile
+                       + ", keeping the networks in use");
+
+            return decltype(networks)::Replicas();
+        }
+
+        auto replicas = networks.replicate(std::move(loaded));
+
+        if (report)
+            report("NNUE networks " + bigFile + " and " + smallFile
+                   + " loaded, in use from the next search");
+
+        return replicas;
+    });
+}
+
+// Replaces the networks by the ones loaded in the background, if they are ready,
+// or once they are if asked to wait. It must not be called during a search.
+void Engine::install_loaded_networks(bool wait) {
+    if (!loadedNetworks.valid()
+        || (!wait
+            && loadedNetworks.wait_for(std::chrono::seconds(0)) != std::future_status::ready))
+        return;
+
+    auto replicas     = loadedNetworks.get();
+    networkSwapFailed = replicas.empty();
+
+    if (networkSwapFailed)
+        return;
+
+    wait_for_search_finished();
+    networks.replace(std::move(replicas));
+    threads.clear_network_caches();
+    threads.ensure_network_replicated();
+}
+
 void Engine::save_network(const std::pair<std::optional<std::string>, std::string> files[2]) {
+    install_loaded_networks(true);
     networks.modify_and_replicate([&files](NN::Networks& networks_) {
         networks_.big.save(files[0].first);
         networks_.small.save(files[1].first);
     });
 }
 
+void Engine::save_mapped_network(
+  const std::pair<std::optional<std::string>, std::string> files[2]) {
+    networks->big.save_mapped(files[0].first);
+    networks->small.save_mapped(files[1].first);
+}
+
 // utility functions
 
 void Engine::trace_eval() const {
@@ -298,6 +474,95 @@ void Engine::trace_eval() const {
     sync_cout << "\n" << Eval::trace(p, *networks) << sync_endl;
 }
 
+// Reads FENs from the stream, one per line, until its end or a line "end", and prints the
+// static evaluation of each position in centipawns, from the point of view of the side to
+// move, or "none" for positions in check. The FENs are read in batches of batchSize, split
+// among the threads, and the results of a batch are printed in order once it is complete.
+void Engine::evaluate_fens(std::istream& is, size_t batchSize) {
+    wait_for_search_finished();
+    verify_networks();
+
+    const size_t threadCount = threads.num_threads();
+    const bool   chess960    = options["UCI_Chess960"];
+
+    // Each thread keeps its accumulators and caches over all the batches
+    std::vector<Eval::NNUE::AccumulatorStack>                   accumulators(threadCount);
+    std::vector<std::unique_ptr<Eval::NNUE::AccumulatorCaches>> caches(threadCount);
+
+    for (auto& c : caches)
+        c = std::make_unique<Eval::NNUE::AccumulatorCaches>(*networks, options["SmallNetOnly"]);
+
+    std::vector<std::string> fens;
+    std::string              line;
+    bool                     done = false;
+
+    while (!done)
+    {
+        fens.clear();
+
+        while (fens.size() < batchSize)
+        {
+            if (!std::getline(is, line) || line == "end")
+            {
+                done = true;
+                break;
+            }
+
+            if (!line.empty())
+                fens.push_back(line);
+        }
+
+        const size_t           count  = fens.size();
+        const size_t           stride = (count + threadCount - 1) / threadCount;
+        std::vector<StateInfo> stateInfos(count);
+        std::vector<Position>  positions(count);
+        std::vector<Value>     values(count, VALUE_NONE);
+
+        for (size_t i = 0; i < threadCount; ++i)
+            threads.run_on_thread(i, [&, i]() {
+                const size_t start = std::min(i * stride, count);
+                const size_t end   = std::min(start + stride, count);
+
+                std::vector<const Position*> batch;
+                std::vector<Value>           batchValues;
+
+                for (size_t j = start; j < end; ++j)
+                {
+                    positions[j].set(fens[j], chess960, &stateInfos[j]);
+
+                    if (!positions[j].checkers())
+                        batch.push_back(&positions[j]);
+                }
+
+                batchValues.resize(batch.size());
+                Eval::evaluate_batch(*networks, batch.data(), batch.size(), accumulators[i],
+                                     *caches[i], batchValues.data());
+
+                for (size_t k = 0; k < batch.size(); ++k)
+                    values[batch[k] - positions.data()] = batchValues[k];
+            });
+
+        for (size_t i = 0; i < threadCount; ++i)
+            threads.wait_on_thread(i);
+
+        if (!count)
+            continue;
+
+        std::ostringstream ss;
+        for (size_t j = 0; j < count; ++j)
+        {
+            ss << (j ? "\n" : "");
+
+            if (values[j] == VALUE_NONE)
+                ss << "none";
+            else
+                ss << UCIEngine::to_cp(values[j], positions[j]);
+        }
+
+        sync_cout << ss.str() << sync_endl;
+    }
+}
+
 const OptionsMap& Engine::get_options() const { return options; }
 OptionsMap&       Engine::get_options() { return options; }
 
@@ -313,6 +578,9 @@ std::string Engine::visualize() const {
 
 int Engine::get_hashfull(int maxAge) const { return tt.hashfull(maxAge); }
 
+// Microseconds spent by the threads synchronizing in the last deterministic search
+uint64_t Engine::get_sync_time() const { return threads.sync_time(); }
+
 std::vector<std::pair<size_t, size_t>> Engine::get_bound_thread_count_by_numa_node() const {
     auto                                   counts = threads.get_bound_thread_count_by_numa_node();
     const NumaConfig&                      cfg    = numaContext.get_numa_config();
@@ -354,6 +622,55 @@ std::string Engine::thread_binding_information_as_string() const {
     return ss.str();
 }
 
+template<typename T>
+std::string Engine::stats_as_string() const {
+    std::stringstream ss;
+    ss << threads.stats<T>();
+    return ss.str();
+}
+
+template<typename T>
+void Engine::clear_stats() {
+    wait_for_search_finished();
+    threads.clear_stats<T>();
+}
+
+template std::string Engine::stats_as_string<TTStats>() const;
+template std::string Engine::stats_as_string<Eval::EvalCacheStats>() const;
+template std::string Engine::stats_as_string<Eval::NNUE::NnueStats>() const;
+template void        Engine::clear_stats<TTStats>();
+template void        Engine::clear_stats<Eval::EvalCacheStats>();
+template void        Engine::clear_stats<Eval::NNUE::NnueStats>();
+
+size_t Engine::nnue_memory_per_thread() const {
+    return threads.main_thread()->worker->nnue_memory_usage();
+}
+
+std::string Engine::page_size_information_as_string() const {
+    auto to_string = [](size_t pageSize) -> std::string {
+        if (pageSize == 0)
+            return "default";
+        return pageSize >= 1024 * 1024 * 1024 ? std::to_string(pageSize >> 30) + "GB"
+                                              : std::to_string(pageSize >> 20) + "MB";
+    };
+
+    return "hash " + to_string(tt.page_size()) + ", networks "
+         + to_string(networks->big.page_size()) + ", threads "
+         + to_string(large_page_size(threads.main_thread()->worker.get()));
+}
+
+std::string Engine::hash_placement_information_as_string() const {
+    auto boundThreadsByNode = threads.get_bound_thread_count_by_numa_node();
+    auto nodeCount          = std::count_if(boundThreadsByNode.begin(), boundThreadsByNode.end(),
+                                            [](size_t n) { return n > 0; });
+
+    if (nodeCount == 0)
+        return "Hash placement: threads are not bound to NUMA nodes, interleaving has no effect";
+
+    return "Hash placement: interleaved over " + std::to_string(nodeCount) + " NUMA node"
+         + (nodeCount > 1 ? "s" : "");
+}
+
 std::string Engine::thread_allocation_information_as_string() const {
     std::stringstream ss;
 
@@ -22,12 +22,14 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
+#include "history.h"
 #include "nnue/network.h"
 #include "numa.h"
 #include "position.h"
@@ -53,9 +55,11 @@ class Engine {
     Engine& operator=(const Engine&) = delete;
     Engine& operator=(Engine&&)      = delete;
 
-    ~Engine() { wait_for_search_finished(); }
+    ~Engine();
 
     std::uint64_t perft(const std::string& fen, Depth depth, bool isChess960);
+    void          benchmark_tt_layouts(size_t mbSize, Depth depth);
+    void          benchmark_nnue(int repetitions);
 
     // non blocking call to start searching
     void go(Search::LimitsType&);
@@ -75,6 +79,9 @@ class Engine {
     void set_ponderhit(bool);
     void search_clear();
 
+    bool save_hash(const std::string& file);
+    bool load_hash(const std::string& file);
+
     void set_on_update_no_moves(std::function<void(const InfoShort&)>&&);
     void set_on_update_full(std::function<void(const InfoFull&)>&&);
     void set_on_iter(std::function<void(const InfoIter&)>&&);
@@ -88,15 +95,23 @@ class Engine {
     void load_big_network(const std::string& file);
     void load_small_network(const std::string& file);
     void save_network(const std::pair<std::optional<std::string>, std::string> files[2]);
+    void save_mapped_network(const std::pair<std::optional<std::string>, std::string> files[2]);
 
     // utility functions
 
     void trace_eval() const;
+    void evaluate_fens(std::istream& is, size_t batchSize);
 
     const OptionsMap& get_options() const;
     OptionsMap&       get_options();
 
-    int get_hashfull(int maxAge = 0) const;
+    int         get_hashfull(int maxAge = 0) const;
+    uint64_t    get_sync_time() const;
+    // T is one of TTStats, Eval::EvalCacheStats and Eval::NNUE::NnueStats
+    template<typename T>
+    std::string stats_as_string() const;
+    template<typename T>
+    void        clear_stats();
 
     std::string                            fen() const;
     void                                   flip();
@@ -106,8 +121,14 @@ class Engine {
     std::string                            numa_config_information_as_string() const;
     std::string                            thread_allocation_information_as_string() const;
     std::string                            thread_binding_information_as_string() const;
+    std::string                            hash_placement_information_as_string() const;
+    std::string                            page_size_information_as_string() const;
+    size_t                                 nnue_memory_per_thread() const;
 
    private:
+    void load_networks_in_background();
+    void install_loaded_networks(bool wait);
+
     const std::string binaryDirectory;
 
     NumaReplicationContext numaContext;
@@ -118,7 +139,15 @@ class Engine {
     OptionsMap                               options;
     ThreadPool                               threads;
     TranspositionTable                       tt;
+    Search::SearchingTable                   searchingTable;
     LazyNumaReplicated<Eval::NNUE::Networks> networks;
+    LazyNumaReplicated<SharedHistories>      sharedHistories;
+
+    // Networks loaded in the background with HotSwapNetworks, installed by the next
+    // search. There are no replicas if a file could not be loaded, the networks in
+    // use then no longer match the EvalFile options, see verify_networks().
+    std::future<LazyNumaReplicated<Eval::NNUE::Networks>::Replicas> loadedNetworks;
+    bool                                                            networkSwapFailed = false;
 
     Search::SearchManager::UpdateContext  updateContext;
     std::function<void(std::string_view)> onVerifyNetworks;
@@ -27,6 +27,7 @@
 #include <memory>
 #include <sstream>
 #include <tuple>
+#include <vector>
 
 #include "nnue/network.h"
 #include "nnue/nnue_misc.h"
@@ -48,45 +49,162 @@ int Eval::simple_eval(const Position& pos) {
 
 bool Eval::use_smallnet(const Position& pos) { return std::abs(simple_eval(pos)) > 962; }
 
+// Turns the output of a network into the final evaluation of the position
+static Value adjust(const Position& pos, Value nnue, Value psqt, Value positional, int optimism) {
+
+    // Blend optimism and eval with nnue complexity
+    int nnueComplexity = std::abs(psqt - positional);
+    optimism += optimism * nnueComplexity / 468;
+    nnue -= nnue * nnueComplexity / 18000;
+
+    int material = 535 * pos.count<PAWN>() + pos.non_pawn_material();
+    int v        = (nnue * (77777 + material) + optimism * (7777 + material)) / 77777;
+
+    // Damp down the evaluation linearly when shuffling
+    v -= v * pos.rule50_count() / 212;
+
+    // Guarantee evaluation does not hit the tablebase range
+    v = std::clamp(v, VALUE_TB_LOSS_IN_MAX_PLY + 1, VALUE_TB_WIN_IN_MAX_PLY - 1);
+
+    return v;
+}
+
 // Evaluate is the evaluator for the outer world. It returns a static evaluation
 // of the position from the point of view of the side to move.
 Value Eval::evaluate(const Eval::NNUE::Networks&    networks,
                      const Position&                pos,
                      Eval::NNUE::AccumulatorStack&  accumulators,
                      Eval::NNUE::AccumulatorCaches& caches,
+                     EvalCache*                     evalCache,
                      int                            optimism) {
 
     assert(!pos.checkers());
 
-    bool smallNet           = use_smallnet(pos);
+    EvalCache::Entry* entry = nullptr;
+    const uint32_t    key32 = uint32_t(pos.key() >> 32) | 1;
+
+    // The accumulators are left as they are on a hit, they are updated
+    // later from the last computed ones, as after a TT hit.
+    if (evalCache)
+    {
+        entry = &evalCache->entry(pos.key());
+        evalCache->stats.add(&EvalCacheStats::probes);
+
+        if (entry->key == key32)
+        {
+            evalCache->stats.add(&EvalCacheStats::hits);
+
+            const Value psqt       = entry->psqt;
+            const Value positional = entry->positional;
+
+            return adjust(pos, (125 * psqt + 131 * positional) / 128, psqt, positional, optimism);
+        }
+    }
+
+    bool smallNet           = caches.small_net_only() || use_smallnet(pos);
     auto [psqt, positional] = smallNet ? networks.small.evaluate(pos, accumulators, &caches.small)
-                                       : networks.big.evaluate(pos, accumulators, &caches.big);
+                                       : networks.big.evaluate(pos, accumulators, caches.big.get());
+
+    accumulators.stats.add(smallNet ? &NNUE::NnueStats::smallNetEvals
+                                    : &NNUE::NnueStats::bigNetEvals);
 
     Value nnue = (125 * psqt + 131 * positional) / 128;
 
     // Re-evaluate the position when higher eval accuracy is worth the time spent
-    if (smallNet && (std::abs(nnue) < 236))
+    if (smallNet && (std::abs(nnue) < 236) && !caches.small_net_only())
     {
-        std::tie(psqt, positional) = networks.big.evaluate(pos, accumulators, &caches.big);
+        accumulators.stats.add(&NNUE::NnueStats::smallNetRejects);
+        accumulators.stats.add(&NNUE::NnueStats::bigNetEvals);
+
+        std::tie(psqt, positional) = networks.big.evaluate(pos, accumulators, caches.big.get());
         nnue                       = (125 * psqt + 131 * positional) / 128;
         smallNet                   = false;
     }
 
-    // Blend optimism and eval with nnue complexity
-    int nnueComplexity = std::abs(psqt - positional);
-    optimism += optimism * nnueComplexity / 468;
-    nnue -= nnue * nnueComplexity / 18000;
+    if (entry)
+        *entry = {key32, psqt, positional};
 
-    int material = 535 * pos.count<PAWN>() + pos.non_pawn_material();
-    int v        = (nnue * (77777 + material) + optimism * (7777 + material)) / 77777;
+    return adjust(pos, nnue, psqt, positional, optimism);
+}
 
-    // Damp down the evaluation linearly when shuffling
-    v -= v * pos.rule50_count() / 212;
 
-    // Guarantee evaluation does not hit the tablebase range
-    v = std::clamp(v, VALUE_TB_LOSS_IN_MAX_PLY + 1, VALUE_TB_WIN_IN_MAX_PLY - 1);
+Eval::EvalCacheStats& Eval::EvalCacheStats::operator+=(const EvalCacheStats& s) {
+    probes += s.probes;
+    hits += s.hits;
+    return *this;
+}
 
-    return v;
+std::ostream& Eval::operator<<(std::ostream& os, [[maybe_unused]] const EvalCacheStats& s) {
+#ifndef EVAL_CACHE_STATS
+    return os << "Eval cache statistics are not available, build with evalcachestats=yes";
+#else
+    os << "Eval cache probes          : " << s.probes
+       << "\n    hits                   : " << s.hits << " (" << percent(s.hits, s.probes) << ")";
+
+    return os;
+#endif
+}
+
+// Evaluates many unrelated positions at once, none of them in check, as evaluate() does
+// with no optimism. The positions are grouped by network and each network evaluates its
+// group in a batch, see Network::evaluate_batch(), which is much faster than refreshing
+// the accumulators of the positions one by one.
+void Eval::evaluate_batch(const Eval::NNUE::Networks&    networks,
+                          const Position* const*         positions,
+                          size_t                         count,
+                          Eval::NNUE::AccumulatorStack&  accumulators,
+                          Eval::NNUE::AccumulatorCaches& caches,
+                          Value*                         values) {
+
+    std::vector<const Position*> smallPositions, bigPositions;
+    std::vector<size_t>          smallIndices, bigIndices;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        assert(!positions[i]->checkers());
+
+        if (caches.small_net_only() || use_smallnet(*positions[i]))
+        {
+            smallPositions.push_back(positions[i]);
+            smallIndices.push_back(i);
+        }
+        else
+        {
+            bigPositions.push_back(positions[i]);
+            bigIndices.push_back(i);
+        }
+    }
+
+    std::vector<NNUE::NetworkOutput> outputs(smallPositions.size());
+    networks.small.evaluate_batch(smallPositions.data(), smallPositions.size(), accumulators,
+                                  &caches.small, outputs.data());
+
+    // Positions that the small net finds balanced go to the big net, like in evaluate()
+    for (size_t j = 0; j < smallPositions.size(); ++j)
+    {
+        const auto [psqt, positional] = outputs[j];
+        const Value nnue              = (125 * psqt + 131 * positional) / 128;
+
+        if (std::abs(nnue) < 236 && !caches.small_net_only())
+        {
+            bigPositions.push_back(smallPositions[j]);
+            bigIndices.push_back(smallIndices[j]);
+        }
+        else
+            values[smallIndices[j]] = adjust(*smallPositions[j], nnue, psqt, positional, 0);
+    }
+
+    outputs.resize(bigPositions.size());
+    networks.big.evaluate_batch(bigPositions.data(), bigPositions.size(), accumulators,
+                                caches.big.get(), outputs.data());
+
+    for (size_t j = 0; j < bigPositions.size(); ++j)
+    {
+        const auto [psqt, positional] = outputs[j];
+        const Value nnue              = (125 * psqt + 131 * positional) / 128;
+
+        values[bigIndices[j]] = adjust(*bigPositions[j], nnue, psqt, positional, 0);
+    }
 }
 
 // Like evaluate(), but instead of returning a value, it returns
@@ -107,12 +225,12 @@ std::string Eval::trace(Position& pos, const Eval::NNUE::Networks& networks) {
 
     ss << std::showpoint << std::showpos << std::fixed << std::setprecision(2) << std::setw(15);
 
-    auto [psqt, positional] = networks.big.evaluate(pos, accumulators, &caches->big);
+    auto [psqt, positional] = networks.big.evaluate(pos, accumulators, caches->big.get());
     Value v                 = psqt + positional;
     v                       = pos.side_to_move() == WHITE ? v : -v;
     ss << "NNUE evaluation        " << 0.01 * UCIEngine::to_cp(v, pos) << " (white side)\n";
 
-    v = evaluate(networks, pos, accumulators, *caches, VALUE_ZERO);
+    v = evaluate(networks, pos, accumulators, *caches, nullptr, VALUE_ZERO);
     v = pos.side_to_move() == WHITE ? v : -v;
     ss << "Final evaluation       " << 0.01 * UCIEngine::to_cp(v, pos) << " (white side)";
     ss << " [with scaled NNUE, ...]";
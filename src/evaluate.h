@@ -19,8 +19,13 @@
 #ifndef EVALUATE_H_INCLUDED
 #define EVALUATE_H_INCLUDED
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
 #include <string>
 
+#include "misc.h"
 #include "types.h"
 
 namespace Stockfish {
@@ -42,6 +47,47 @@ struct AccumulatorCaches;
 class AccumulatorStack;
 }
 
+// Counters of the eval cache of one search thread
+struct EvalCacheStats {
+    StatCounter probes;
+    StatCounter hits;
+
+    void add([[maybe_unused]] StatCounter EvalCacheStats::* counter) {
+#ifdef EVAL_CACHE_STATS
+        ++(this->*counter);
+#endif
+    }
+
+    EvalCacheStats& operator+=(const EvalCacheStats& s);
+};
+
+std::ostream& operator<<(std::ostream& os, const EvalCacheStats& s);
+
+// A lossy cache of the network outputs, keyed by the position key. It lets a search
+// thread skip the networks for positions it has evaluated recently, like the leaves
+// visited again after their TT entry was overwritten. Each thread with the EvalCache
+// option on has its own cache, which must be cleared when the networks change.
+class EvalCache {
+   public:
+    struct Entry {
+        uint32_t key;  // Upper half of the position key with its lowest bit set
+        int32_t  psqt;
+        int32_t  positional;
+    };
+
+    static constexpr size_t Size = 1 << 16;
+
+    void clear() { entries.fill(Entry()); }
+
+    // The entry for the position key, it holds the position if its key matches
+    Entry& entry(Key key) { return entries[key & (Size - 1)]; }
+
+    EvalCacheStats stats;
+
+   private:
+    std::array<Entry, Size> entries;
+};
+
 std::string trace(Position& pos, const Eval::NNUE::Networks& networks);
 
 int   simple_eval(const Position& pos);
@@ -50,7 +96,14 @@ Value evaluate(const NNUE::Networks&          networks,
                const Position&                pos,
                Eval::NNUE::AccumulatorStack&  accumulators,
                Eval::NNUE::AccumulatorCaches& caches,
+               EvalCache*                     evalCache,
                int                            optimism);
+void  evaluate_batch(const NNUE::Networks&          networks,
+                     const Position* const*         positions,
+                     size_t                         count,
+                     Eval::NNUE::AccumulatorStack&  accumulators,
+                     Eval::NNUE::AccumulatorCaches& caches,
+                     Value*                         values);
 }  // namespace Eval
 
 }  // namespace Stockfish
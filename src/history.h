@@ -26,6 +26,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <limits>
+#include <memory>
 #include <type_traits>  // IWYU pragma: keep
 
 #include "misc.h"
@@ -168,6 +169,53 @@ using CorrectionHistory = typename Detail::CorrHistTypedef<T>::type;
 
 using TTMoveHistory = StatsEntry<std::int16_t, 8192>;
 
+// The histories addressed by a key of the position rather than by its moves. They
+// learn the same statistics in every thread, so with the SharedHistories option
+// the threads bound to a NUMA node use a single copy, see SharedHistories.
+struct KeyedHistories {
+    PawnHistory                pawnHistory;
+    CorrectionHistory<Pawn>    pawnCorrectionHistory;
+    CorrectionHistory<Minor>   minorPieceCorrectionHistory;
+    CorrectionHistory<NonPawn> nonPawnCorrectionHistory;
+
+    void clear() {
+        pawnHistory.fill(-1287);
+        pawnCorrectionHistory.fill(5);
+        minorPieceCorrectionHistory.fill(0);
+        nonPawnCorrectionHistory.fill(0);
+    }
+};
+
+// The copy of the KeyedHistories of a NUMA node, as kept by a LazyNumaReplicated.
+// It is empty unless the SharedHistories option is on. The tables are on the heap,
+// so that each replica is allocated on its node when it is copied there.
+class SharedHistories {
+   public:
+    SharedHistories() = default;
+    explicit SharedHistories(bool enabled) {
+        if (enabled)
+        {
+            histories = std::make_unique<KeyedHistories>();
+            histories->clear();
+        }
+    }
+
+    SharedHistories(const SharedHistories& other) :
+        histories(other.histories ? std::make_unique<KeyedHistories>(*other.histories)
+                                  : nullptr) {}
+
+    SharedHistories(SharedHistories&&)            = default;
+    SharedHistories& operator=(SharedHistories&&) = default;
+
+    // The tables, or null when they are not shared. The replica is const, yet all the
+    // threads of the node update the tables through it, with racy writes like those to
+    // the TT, so a search using them is not reproducible.
+    KeyedHistories* racy_tables() const { return histories.get(); }
+
+   private:
+    std::unique_ptr<KeyedHistories> histories;
+};
+
 }  // namespace Stockfish
 
 #endif  // #ifndef HISTORY_H_INCLUDED
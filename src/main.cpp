@@ -25,9 +25,13 @@
 #include "uci.h"
 #include "tune.h"
 
-using namespace Stockfish;
+namespace Stockfish {
 
-int main(int argc, char* argv[]) {
+// A fat binary links several builds of the engine, each one in its own namespace,
+// and calls run() of the build that suits the CPU, see dispatch.cpp.
+int run(int argc, char* argv[]);
+
+int run(int argc, char* argv[]) {
 
     std::cout << engine_info() << std::endl;
 
@@ -42,3 +46,9 @@ int main(int argc, char* argv[]) {
 
     return 0;
 }
+
+}  // namespace Stockfish
+
+#ifndef FAT_BINARY
+int main(int argc, char* argv[]) { return Stockfish::run(argc, argv); }
+#endif
@@ -19,6 +19,11 @@
 #include "memory.h"
 
 #include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
 
 #if __has_include("features.h")
     #include <features.h>
@@ -28,6 +33,14 @@
     #include <sys/mman.h>
 #endif
 
+#if (defined(__linux__) && !defined(__ANDROID__)) || defined(__APPLE__)
+    #define POSIXSHAREDMEMORY
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) \
   || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) \
   || defined(__e2k__)
@@ -66,6 +79,38 @@ using AdjustTokenPrivileges_t =
 
 namespace Stockfish {
 
+namespace {
+
+// The blocks of aligned_large_pages_alloc() that got explicitly requested large pages, with
+// the size of the mapping, needed to free it, and the size of its pages.
+struct LargePageBlock {
+    size_t size;
+    size_t pageSize;
+};
+
+std::mutex                            largePageMutex;
+std::map<const void*, LargePageBlock> largePageBlocks;
+
+void register_large_pages(const void* mem, size_t size, size_t pageSize) {
+    std::lock_guard<std::mutex> lock(largePageMutex);
+    largePageBlocks[mem] = {size, pageSize};
+}
+
+// Returns the size of the mapping if mem was registered, 0 otherwise
+size_t unregister_large_pages(const void* mem) {
+    std::lock_guard<std::mutex> lock(largePageMutex);
+    auto                        it = largePageBlocks.find(mem);
+
+    if (it == largePageBlocks.end())
+        return 0;
+
+    const size_t size = it->second.size;
+    largePageBlocks.erase(it);
+    return size;
+}
+
+}  // namespace
+
 // Wrappers for systems where the c++17 implementation does not guarantee the
 // availability of aligned_alloc(). Memory allocated with std_aligned_alloc()
 // must be freed with std_aligned_free().
@@ -184,8 +229,11 @@ void* aligned_large_pages_alloc(size_t allocSize) {
     // Try to allocate large pages
     void* mem = aligned_large_pages_alloc_windows(allocSize);
 
+    if (mem)
+        register_large_pages(mem, allocSize, GetLargePageMinimum());
+
     // Fall back to regular, page-aligned, allocation if necessary
-    if (!mem)
+    else
         mem = VirtualAlloc(nullptr, allocSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 
     return mem;
@@ -195,6 +243,30 @@ void* aligned_large_pages_alloc(size_t allocSize) {
 
 void* aligned_large_pages_alloc(size_t allocSize) {
 
+    #if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    // Try explicit huge pages first, which only exist if the administrator reserved them, e.g.
+    // through /proc/sys/vm/nr_hugepages. Use 1GB pages when rounding up the size wastes little.
+    for (int pageShift : {30, 21})
+    {
+        const size_t pageSize = size_t(1) << pageShift;
+        const size_t size     = (allocSize + pageSize - 1) / pageSize * pageSize;
+
+        if (size - allocSize > std::max(allocSize / 16, size_t(2 * 1024 * 1024)))
+            continue;
+
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT),
+                         -1, 0);
+
+        if (mem != MAP_FAILED)
+        {
+            register_large_pages(mem, size, pageSize);
+            return mem;
+        }
+    }
+    #endif
+
+    // Otherwise let transparent huge pages back the memory where possible
     #if defined(__linux__)
     constexpr size_t alignment = 2 * 1024 * 1024;  // 2MB page size assumed
     #else
@@ -251,6 +323,8 @@ bool has_large_pages() {
 
 void aligned_large_pages_free(void* mem) {
 
+    unregister_large_pages(mem);
+
     if (mem && !VirtualFree(mem, 0, MEM_RELEASE))
     {
         DWORD err = GetLastError();
@@ -262,7 +336,188 @@ void aligned_large_pages_free(void* mem) {
 
 #else
 
-void aligned_large_pages_free(void* mem) { std_aligned_free(mem); }
+void aligned_large_pages_free(void* mem) {
+
+    #if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    if (const size_t size = unregister_large_pages(mem))
+    {
+        munmap(mem, size);
+        return;
+    }
+    #endif
+
+    std_aligned_free(mem);
+}
 
 #endif
+
+// large_page_size() returns the size of the pages explicitly obtained for a block of
+// aligned_large_pages_alloc(), or 0 if it uses the default pages of the system.
+
+size_t large_page_size(const void* mem) {
+    std::lock_guard<std::mutex> lock(largePageMutex);
+    auto                        it = largePageBlocks.find(mem);
+
+    return it != largePageBlocks.end() ? it->second.pageSize : 0;
+}
+
+// shared_memory_alloc() maps a named POSIX shared memory object of exactly the requested size,
+// creating it when needed. Every process mapping the same name sees the same memory.
+
+#if defined(POSIXSHAREDMEMORY)
+
+void* shared_memory_alloc(const std::string& name, size_t size) {
+
+    // Portable shared memory object names start with a single slash
+    const std::string objectName = name[0] == '/' ? name : "/" + name;
+
+    int fd = shm_open(objectName.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+        return nullptr;
+
+    // A freshly created object has size zero, size it (which zero-fills it). Otherwise
+    // it is only usable if it was created by an engine using the same size.
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (st.st_size == 0 && ftruncate(fd, off_t(size)) == -1)
+        || (st.st_size != 0 && size_t(st.st_size) != size))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping stays valid after closing the descriptor
+
+    if (mem == MAP_FAILED)
+        return nullptr;
+
+    #if defined(MADV_HUGEPAGE)
+    madvise(mem, size, MADV_HUGEPAGE);
+    #endif
+    return mem;
+}
+
+void shared_memory_free(void* mem, size_t size) {
+    if (mem)
+        munmap(mem, size);
+}
+
+#else
+
+void* shared_memory_alloc(const std::string&, size_t) { return nullptr; }
+
+void shared_memory_free(void*, size_t) {}
+
+#endif
+
+// map_file() maps a file read-only with shared pages, so that the memory is backed by the
+// page cache and not copied, and unmap_file() releases such a mapping.
+
+#if defined(_WIN32)
+
+const void* map_file(const std::string& path, size_t* size) {
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+        return nullptr;
+
+    // The view keeps the mapping object alive after closing its handle
+    const void* mem = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    *size = size_t(fileSize.QuadPart);
+    return mem;
+}
+
+void unmap_file(const void* mem, size_t) {
+    if (mem)
+        UnmapViewOfFile(mem);
+}
+
+#elif defined(POSIXSHAREDMEMORY)
+
+const void* map_file(const std::string& path, size_t* size) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* mem = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mem == MAP_FAILED)
+        return nullptr;
+
+    *size = size_t(st.st_size);
+    return mem;
+}
+
+void unmap_file(const void* mem, size_t size) {
+    if (mem)
+        munmap(const_cast<void*>(mem), size);
+}
+
+#else
+
+const void* map_file(const std::string&, size_t*) { return nullptr; }
+
+void unmap_file(const void*, size_t) {}
+
+#endif
+
+// available_memory() returns what the OS estimates it can still provide without swapping,
+// which with overcommit may be much less than what an allocation is granted.
+
+#if defined(_WIN32)
+
+size_t available_memory() {
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? size_t(status.ullAvailPhys) : 0;
+}
+
+#elif defined(__linux__)
+
+size_t available_memory() {
+    std::ifstream meminfo("/proc/meminfo");
+    std::string   name;
+    size_t        kB;
+
+    while (meminfo >> name >> kB)
+    {
+        if (name == "MemAvailable:")
+            return kB * 1024;
+
+        meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+
+    return 0;
+}
+
+#else
+
+size_t available_memory() { return 0; }
+
+#endif
+
 }  // namespace Stockfish
@@ -24,6 +24,7 @@
 #include <cstdint>
 #include <memory>
 #include <new>
+#include <string>
 #include <type_traits>
 #include <utility>
 
@@ -40,6 +41,25 @@ void  aligned_large_pages_free(void* mem);
 
 bool has_large_pages();
 
+// Size of the pages explicitly obtained for memory from aligned_large_pages_alloc(), 0 if it
+// uses the default pages (which on Linux may still be transparent huge pages).
+size_t large_page_size(const void* mem);
+
+// Memory shared between processes through a named object. The object is created zero-filled
+// if it does not exist yet, and outlives the process. Returns nullptr if shared memory is not
+// supported on this platform or an object of the same name but a different size exists.
+void* shared_memory_alloc(const std::string& name, size_t size);
+void  shared_memory_free(void* mem, size_t size);
+
+// Maps a whole file read-only. Every process mapping the same file shares its pages through
+// the page cache. Returns nullptr if the file can't be opened or mapped, or if file mapping
+// is not supported on this platform.
+const void* map_file(const std::string& path, size_t* size);
+void        unmap_file(const void* mem, size_t size);
+
+// Memory the OS can provide at once, in bytes, 0 if unknown
+size_t available_memory();
+
 // Frees memory which was placed there with placement new.
 // Works for both single objects and arrays of unknown bound.
 template<typename T, typename FREE_FUNC>
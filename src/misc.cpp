@@ -471,6 +471,12 @@ std::optional<std::string> read_file_to_string(const std::string& path) {
     return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
 }
 
+std::string percent(uint64_t n, uint64_t total) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(2) << (total ? 100.0 * n / total : 0.0) << "%";
+    return ss.str();
+}
+
 void remove_whitespace(std::string& s) {
     s.erase(std::remove_if(s.begin(), s.end(), [](char c) { return std::isspace(c); }), s.end());
 }
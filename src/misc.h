@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <cstddef>
@@ -108,6 +109,35 @@ inline std::vector<std::string_view> split(std::string_view s, std::string_view
 void remove_whitespace(std::string& s);
 bool is_whitespace(std::string_view s);
 
+// n as a percentage of total, with two decimals
+std::string percent(uint64_t n, uint64_t total);
+
+// A statistics counter, written by its search thread only, but which the UCI thread
+// may read during the search. As for the node counts, a relaxed atomic is enough, and
+// with a single writer the increment needs no read-modify-write.
+class StatCounter {
+   public:
+    StatCounter(uint64_t v = 0) :
+        value(v) {}
+    StatCounter(const StatCounter& c) :
+        value(uint64_t(c)) {}
+
+    StatCounter& operator=(const StatCounter& c) {
+        value.store(uint64_t(c), std::memory_order_relaxed);
+        return *this;
+    }
+    StatCounter& operator+=(uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        return *this;
+    }
+    StatCounter& operator++() { return *this += 1; }
+
+    operator uint64_t() const { return value.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<uint64_t> value;
+};
+
 enum SyncCout {
     IO_LOCK,
     IO_UNLOCK
@@ -18,7 +18,10 @@
 
 #include "network.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -32,6 +35,7 @@
 #include "../evaluate.h"
 #include "../memory.h"
 #include "../misc.h"
+#include "../movegen.h"
 #include "../position.h"
 #include "../types.h"
 #include "nnue_architecture.h"
@@ -46,8 +50,19 @@
 //     const unsigned int         gEmbeddedNNUESize;    // the size of the embedded file
 // Note that this does not work in Microsoft Visual Studio.
 #if !defined(_MSC_VER) && !defined(NNUE_EMBEDDING_OFF)
+    #if defined(FAT_BINARY)
+// A fat binary embeds the networks once for all its builds, see dispatch.cpp
+INCBIN_EXTERN(unsigned char, EmbeddedNNUEBig);
+INCBIN_EXTERN(unsigned char, EmbeddedNNUESmall);
+    #elif defined(NNUE_EMBEDDING_MAPPED)
+// The networks converted at build time to the in-memory layout of this build,
+// see the embedmapped option of the Makefile
+INCBIN(EmbeddedNNUEBig, EvalFileDefaultNameBig ".map");
+INCBIN(EmbeddedNNUESmall, EvalFileDefaultNameSmall ".map");
+    #else
 INCBIN(EmbeddedNNUEBig, EvalFileDefaultNameBig);
 INCBIN(EmbeddedNNUESmall, EvalFileDefaultNameSmall);
+    #endif
 #else
 const unsigned char        gEmbeddedNNUEBigData[1]   = {0x0};
 const unsigned char* const gEmbeddedNNUEBigEnd       = &gEmbeddedNNUEBigData[1];
@@ -73,6 +88,62 @@ struct EmbeddedNNUE {
 
 using namespace Stockfish::Eval::NNUE;
 
+// A pre-transformed network file holds the feature transformer and the layer stacks exactly
+// as they are laid out in memory once a .nnue file has been read, so it can be memory-mapped
+// and used in place. The layout depends on the SIMD code paths of the build, so a file can
+// only be read by a build using the same ones. The header and the description are followed
+// by the feature transformer and the layer stacks, each starting on a page boundary.
+constexpr char        MappedNetMagic[8]  = {'S', 'F', 'N', 'N', 'M', 'A', 'P', '1'};
+constexpr std::size_t MappedNetAlignment = 4096;
+
+// The SIMD code paths which the weight permutations and paddings depend on
+constexpr char MappedNetLayout[] = ""
+#if defined(USE_AVX512)
+                                   " avx512"
+#endif
+#if defined(USE_VNNI)
+                                   " vnni"
+#endif
+#if defined(USE_AVXVNNI)
+                                   " avxvnni"
+#endif
+#if defined(USE_AVX2)
+                                   " avx2"
+#endif
+#if defined(USE_SSE41)
+                                   " sse41"
+#endif
+#if defined(USE_SSSE3)
+                                   " ssse3"
+#endif
+#if defined(USE_SSE2)
+                                   " sse2"
+#endif
+#if defined(USE_NEON)
+                                   " neon" stringify(USE_NEON)
+#endif
+#if defined(USE_NEON_DOTPROD)
+                                   " dotprod"
+#endif
+  ;
+
+// Fields are stored in native byte order, a mismatch shows up in the hash value
+struct MappedNetHeader {
+    char          magic[8];
+    std::uint32_t hashValue;
+    std::uint32_t layerStacks;
+    std::uint64_t transformerSize;
+    std::uint64_t archSize;
+    char          layout[64];
+    std::uint64_t descriptionSize;
+};
+
+static_assert(sizeof(MappedNetLayout) <= sizeof(MappedNetHeader::layout));
+
+constexpr std::size_t align_mapped(std::size_t offset) {
+    return (offset + MappedNetAlignment - 1) / MappedNetAlignment * MappedNetAlignment;
+}
+
 EmbeddedNNUE get_embedded(EmbeddedNNUEType type) {
     if (type == EmbeddedNNUEType::BIG)
         return EmbeddedNNUE(gEmbeddedNNUEBigData, gEmbeddedNNUEBigEnd, gEmbeddedNNUEBigSize);
@@ -114,16 +185,27 @@ Network<Arch, Transformer>::Network(const Network<Arch, Transformer>& other) :
     evalFile(other.evalFile),
     embeddedType(other.embeddedType) {
 
+    // A mapped network is shared, not copied
+    if (other.mappedFile)
+    {
+        mappedFile         = other.mappedFile;
+        featureTransformer = other.featureTransformer;
+        network            = other.network;
+        return;
+    }
+
     if (other.featureTransformer)
-        featureTransformer = make_unique_large_page<Transformer>(*other.featureTransformer);
+        transformerStorage = make_unique_large_page<Transformer>(*other.featureTransformer);
 
-    network = make_unique_aligned<Arch[]>(LayerStacks);
+    networkStorage     = make_unique_aligned<Arch[]>(LayerStacks);
+    featureTransformer = transformerStorage.get();
+    network            = networkStorage.get();
 
     if (!other.network)
         return;
 
     for (std::size_t i = 0; i < LayerStacks; ++i)
-        network[i] = other.network[i];
+        networkStorage[i] = other.network[i];
 }
 
 template<typename Arch, typename Transformer>
@@ -132,16 +214,30 @@ Network<Arch, Transformer>::operator=(const Network<Arch, Transformer>& other) {
     evalFile     = other.evalFile;
     embeddedType = other.embeddedType;
 
+    if (other.mappedFile)
+    {
+        mappedFile         = other.mappedFile;
+        featureTransformer = other.featureTransformer;
+        network            = other.network;
+        transformerStorage.reset();
+        networkStorage.reset();
+        return *this;
+    }
+
+    mappedFile.reset();
+
     if (other.featureTransformer)
-        featureTransformer = make_unique_large_page<Transformer>(*other.featureTransformer);
+        transformerStorage = make_unique_large_page<Transformer>(*other.featureTransformer);
 
-    network = make_unique_aligned<Arch[]>(LayerStacks);
+    networkStorage     = make_unique_aligned<Arch[]>(LayerStacks);
+    featureTransformer = transformerStorage.get();
+    network            = networkStorage.get();
 
     if (!other.network)
         return *this;
 
     for (std::size_t i = 0; i < LayerStacks; ++i)
-        network[i] = other.network[i];
+        networkStorage[i] = other.network[i];
 
     return *this;
 }
@@ -207,6 +303,54 @@ bool Network<Arch, Transformer>::save(const std::optional<std::string>& filename
 }
 
 
+// Writes the parameters as a pre-transformed network file, which load() maps in place
+template<typename Arch, typename Transformer>
+bool Network<Arch, Transformer>::save_mapped(const std::optional<std::string>& filename) const {
+    const std::string& name = evalFile.current;
+
+    if (name.empty() || name == "None")
+    {
+        sync_cout << "Failed to export a mapped net. No net is loaded" << sync_endl;
+        return false;
+    }
+
+    const std::string  actualFilename = filename.value_or(name + ".map");
+    const std::string& description    = evalFile.netDescription;
+
+    MappedNetHeader header{};
+    std::memcpy(header.magic, MappedNetMagic, sizeof(MappedNetMagic));
+    std::memcpy(header.layout, MappedNetLayout, sizeof(MappedNetLayout));
+    header.hashValue       = Network::hash;
+    header.layerStacks     = LayerStacks;
+    header.transformerSize = sizeof(Transformer);
+    header.archSize        = sizeof(Arch);
+    header.descriptionSize = description.size();
+
+    const std::size_t transformerOffset = align_mapped(sizeof(header) + description.size());
+    const std::size_t networkOffset     = align_mapped(transformerOffset + sizeof(Transformer));
+
+    std::ofstream stream(actualFilename, std::ios_base::binary);
+    auto          pad_to = [&](std::size_t offset) {
+        while (std::size_t(stream.tellp()) < offset && stream)
+            stream.put('\0');
+    };
+
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(description.data(), description.size());
+    pad_to(transformerOffset);
+    stream.write(reinterpret_cast<const char*>(featureTransformer), sizeof(Transformer));
+    pad_to(networkOffset);
+    stream.write(reinterpret_cast<const char*>(network), sizeof(Arch) * LayerStacks);
+
+    const bool saved = bool(stream);
+
+    sync_cout << (saved ? "Mapped network saved successfully to " + actualFilename
+                        : "Failed to export a mapped net")
+              << sync_endl;
+    return saved;
+}
+
+
 template<typename Arch, typename Transformer>
 NetworkOutput
 Network<Arch, Transformer>::evaluate(const Position&                         pos,
@@ -228,13 +372,82 @@ Network<Arch, Transformer>::evaluate(const Position&                         pos
 }
 
 
+// Evaluates unrelated positions, each from scratch, writing the output of positions[i]
+// to outputs[i]. The positions are visited by layer stack, then by king squares, so that
+// consecutive refreshes start from the same cache entries, and they are handled in chunks,
+// first transformed and then propagated, so that the weights of each stage stay in cache.
+template<typename Arch, typename Transformer>
+void Network<Arch, Transformer>::evaluate_batch(
+  const Position* const*                  positions,
+  size_t                                  count,
+  AccumulatorStack&                       accumulatorStack,
+  AccumulatorCaches::Cache<FTDimensions>* cache,
+  NetworkOutput*                          outputs) const {
+
+    constexpr uint64_t alignment = CacheLineSize;
+    constexpr size_t   ChunkSize = 8;
+
+    alignas(alignment) TransformedFeatureType
+      transformedFeatures[ChunkSize][FeatureTransformer<FTDimensions>::BufferSize];
+    std::int32_t psqt[ChunkSize];
+
+    ASSERT_ALIGNED(transformedFeatures, alignment);
+
+    auto bucket_of = [](const Position& pos) { return (pos.count<ALL_PIECES>() - 1) / 4; };
+    auto sort_key  = [&](const Position& pos) {
+        return bucket_of(pos) << 12 | int(pos.square<KING>(WHITE)) << 6
+             | int(pos.square<KING>(BLACK));
+    };
+
+    std::vector<std::pair<int, size_t>> order(count);
+    for (size_t i = 0; i < count; ++i)
+        order[i] = {sort_key(*positions[i]), i};
+
+    std::sort(order.begin(), order.end());
+
+    for (size_t first = 0; first < count; first += ChunkSize)
+    {
+        const size_t len = std::min(ChunkSize, count - first);
+
+        for (size_t j = 0; j < len; ++j)
+        {
+            const Position& pos = *positions[order[first + j].second];
+
+            accumulatorStack.reset();
+            psqt[j] = featureTransformer->transform(pos, accumulatorStack, cache,
+                                                    transformedFeatures[j], bucket_of(pos));
+        }
+
+        for (size_t j = 0; j < len; ++j)
+        {
+            const size_t i          = order[first + j].second;
+            const auto   positional =
+              network[bucket_of(*positions[i])].propagate(transformedFeatures[j]);
+
+            outputs[i] = {static_cast<Value>(psqt[j] / OutputScale),
+                          static_cast<Value>(positional / OutputScale)};
+        }
+    }
+}
+
+
+// Whether the given file, or the default net if it is empty, is the loaded one
+template<typename Arch, typename Transformer>
+bool Network<Arch, Transformer>::is_loaded(std::string evalfilePath) const {
+    if (evalfilePath.empty())
+        evalfilePath = evalFile.defaultName;
+
+    return evalFile.current == evalfilePath;
+}
+
+
 template<typename Arch, typename Transformer>
 void Network<Arch, Transformer>::verify(std::string                                  evalfilePath,
                                         const std::function<void(std::string_view)>& f) const {
     if (evalfilePath.empty())
         evalfilePath = evalFile.defaultName;
 
-    if (evalFile.current != evalfilePath)
+    if (!is_loaded(evalfilePath))
     {
         if (f)
         {
@@ -298,11 +511,202 @@ Network<Arch, Transformer>::trace_evaluate(const Position&
 }
 
 
+namespace {
+
+// Bytes of parameters and activations a layer touches in one call, counting the
+// whole weight matrix for the sparse input layer, so its rate is a dense equivalent.
+template<typename Layer>
+constexpr std::uint64_t layer_bytes() {
+    return (std::is_empty_v<Layer> ? 0 : sizeof(Layer))
+         + Layer::InputDimensions * sizeof(typename Layer::InputType)
+         + Layer::OutputDimensions * sizeof(typename Layer::OutputType);
+}
+
+}  // namespace
+
+
+// Times each stage of the evaluation on the positions reached by the legal moves from pos,
+// adding the results to timings. A refresh is timed once per position, as the cache entry
+// would be up to date if it were repeated, while the other stages are too short for the
+// clock and are timed over the given number of repetitions. The layers are fed with the
+// outputs of the previous stage on each of the positions, in turn.
+template<typename Arch, typename Transformer>
+void Network<Arch, Transformer>::benchmark_stages(
+  Position&                               pos,
+  AccumulatorStack&                       accumulatorStack,
+  AccumulatorCaches::Cache<FTDimensions>* cache,
+  int                                     repetitions,
+  NnueBenchmark&                          timings) const {
+
+    using FC0 = decltype(Arch::fc_0);
+    using FC1 = decltype(Arch::fc_1);
+    using FC2 = decltype(Arch::fc_2);
+    using AC0 = decltype(Arch::ac_0);
+    using AC1 = decltype(Arch::ac_1);
+    using SQR = decltype(Arch::ac_sqr_0);
+
+    struct alignas(CacheLineSize) Buffers {
+        alignas(CacheLineSize) TransformedFeatureType features[Transformer::BufferSize];
+        alignas(CacheLineSize) typename FC0::OutputBuffer fc_0_out;
+        alignas(CacheLineSize) typename SQR::OutputType
+          ac_sqr_0_out[ceil_to_multiple<IndexType>(Arch::FC_0_OUTPUTS * 2, 32)];
+        alignas(CacheLineSize) typename AC0::OutputBuffer ac_0_out;
+        alignas(CacheLineSize) typename FC1::OutputBuffer fc_1_out;
+        alignas(CacheLineSize) typename AC1::OutputBuffer ac_1_out;
+        alignas(CacheLineSize) typename FC2::OutputBuffer fc_2_out;
+    };
+
+    constexpr std::uint64_t HalfBytes =
+      FTDimensions * sizeof(BiasType) + PSQTBuckets * sizeof(PSQTWeightType);
+    constexpr std::uint64_t RowBytes =
+      FTDimensions * sizeof(WeightType) + PSQTBuckets * sizeof(PSQTWeightType);
+
+    const std::uint64_t reps = repetitions;
+
+    auto time = [&](NnueStage stage, std::uint64_t calls, std::uint64_t bytes, auto&& f) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        timings[stage].calls += calls;
+        timings[stage].nanoseconds +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        timings[stage].bytes += calls * bytes;
+    };
+
+    MoveList<LEGAL> moves(pos);
+    StateInfo       st;
+
+    // A refresh adds and removes the pieces that differ from the cache entry, then
+    // reads and writes the entry, and copies it to the accumulator.
+    for (const auto& m : moves)
+    {
+        pos.do_move(m, st);
+        accumulatorStack.reset();
+
+        std::uint64_t bytes = 0;
+        for (Color perspective : {WHITE, BLACK})
+        {
+            const auto& entry = (*cache)[pos.square<KING>(perspective)][perspective];
+
+            for (Color c : {WHITE, BLACK})
+                for (PieceType pt = PAWN; pt <= KING; ++pt)
+                {
+                    const Bitboard cached = entry.byColorBB[c] & entry.byTypeBB[pt];
+                    bytes += popcount(cached ^ pos.pieces(c, pt)) * RowBytes;
+                }
+
+            bytes += 3 * HalfBytes;
+        }
+
+        time(STAGE_REFRESH, 1, bytes,
+             [&] { accumulatorStack.evaluate(pos, *featureTransformer, *cache); });
+
+        pos.undo_move(m);
+    }
+
+    // Incremental updates from the root, skipping the king moves which need a refresh
+    auto             buffers = make_unique_aligned<Buffers[]>(moves.size());
+    std::vector<int> buckets;
+
+    accumulatorStack.reset();
+    accumulatorStack.evaluate(pos, *featureTransformer, *cache);
+
+    for (const auto& m : moves)
+    {
+        if (type_of(pos.moved_piece(m)) == KING)
+            continue;
+
+        const DirtyPiece dp     = pos.do_move(m, st, pos.gives_check(m), nullptr);
+        const int        bucket = (pos.count<ALL_PIECES>() - 1) / 4;
+        Buffers&         b      = buffers[buckets.size()];
+
+        const std::uint64_t changed = 1 + (dp.to != SQ_NONE) + (dp.remove_sq != SQ_NONE)
+                                    + (dp.add_sq != SQ_NONE);
+
+        accumulatorStack.push(dp);
+
+        time(STAGE_UPDATE, reps, 2 * (2 * HalfBytes + changed * RowBytes), [&] {
+            for (std::uint64_t r = 0; r < reps; ++r)
+            {
+                accumulatorStack.pop();
+                accumulatorStack.push(dp);
+                accumulatorStack.evaluate(pos, *featureTransformer, *cache);
+            }
+        });
+
+        time(STAGE_TRANSFORM, reps, 2 * HalfBytes + FTDimensions * sizeof(TransformedFeatureType),
+             [&] {
+                 for (std::uint64_t r = 0; r < reps; ++r)
+                     featureTransformer->transform(pos, accumulatorStack, cache, b.features,
+                                                   bucket);
+             });
+
+        time(STAGE_EVALUATE, reps,
+             2 * (2 * HalfBytes + changed * RowBytes) + 2 * HalfBytes
+               + FTDimensions * sizeof(TransformedFeatureType) + layer_bytes<FC0>()
+               + layer_bytes<SQR>() + layer_bytes<AC0>() + layer_bytes<FC1>()
+               + layer_bytes<AC1>() + layer_bytes<FC2>(),
+             [&] {
+                 for (std::uint64_t r = 0; r < reps; ++r)
+                 {
+                     accumulatorStack.pop();
+                     accumulatorStack.push(dp);
+                     evaluate(pos, accumulatorStack, cache);
+                 }
+             });
+
+        buckets.push_back(bucket);
+        accumulatorStack.pop();
+        pos.undo_move(m);
+    }
+
+    const std::uint64_t n = buckets.size();
+
+    auto time_layer = [&](NnueStage stage, std::uint64_t bytes, auto&& propagate) {
+        time(stage, reps * n, bytes, [&] {
+            for (std::uint64_t r = 0; r < reps; ++r)
+                for (std::uint64_t i = 0; i < n; ++i)
+                    propagate(network[buckets[i]], buffers[i]);
+        });
+    };
+
+    time_layer(STAGE_FC_0, layer_bytes<FC0>(),
+               [](const Arch& net, Buffers& b) { net.fc_0.propagate(b.features, b.fc_0_out); });
+    time_layer(STAGE_AC_SQR_0, layer_bytes<SQR>(), [](const Arch& net, Buffers& b) {
+        net.ac_sqr_0.propagate(b.fc_0_out, b.ac_sqr_0_out);
+    });
+    time_layer(STAGE_AC_0, layer_bytes<AC0>(),
+               [](const Arch& net, Buffers& b) { net.ac_0.propagate(b.fc_0_out, b.ac_0_out); });
+
+    for (std::uint64_t i = 0; i < n; ++i)
+        std::memcpy(buffers[i].ac_sqr_0_out + Arch::FC_0_OUTPUTS, buffers[i].ac_0_out,
+                    Arch::FC_0_OUTPUTS * sizeof(typename AC0::OutputType));
+
+    time_layer(STAGE_FC_1, layer_bytes<FC1>(), [](const Arch& net, Buffers& b) {
+        net.fc_1.propagate(b.ac_sqr_0_out, b.fc_1_out);
+    });
+    time_layer(STAGE_AC_1, layer_bytes<AC1>(),
+               [](const Arch& net, Buffers& b) { net.ac_1.propagate(b.fc_1_out, b.ac_1_out); });
+    time_layer(STAGE_FC_2, layer_bytes<FC2>(),
+               [](const Arch& net, Buffers& b) { net.fc_2.propagate(b.ac_1_out, b.fc_2_out); });
+}
+
+
 template<typename Arch, typename Transformer>
 void Network<Arch, Transformer>::load_user_net(const std::string& dir,
                                                const std::string& evalfilePath) {
     std::ifstream stream(dir + evalfilePath, std::ios::binary);
-    auto          description = load(stream);
+    char          magic[sizeof(MappedNetMagic)] = {};
+
+    // Pre-transformed network files are mapped instead of read
+    const bool mapped = stream.read(magic, sizeof(magic))
+                     && std::memcmp(magic, MappedNetMagic, sizeof(magic)) == 0;
+
+    stream.clear();
+    stream.seekg(0);
+
+    auto description = mapped ? load_mapped(dir + evalfilePath) : load(stream);
 
     if (description.has_value())
     {
@@ -324,6 +728,23 @@ void Network<Arch, Transformer>::load_internal() {
     };
 
     const auto embedded = get_embedded(embeddedType);
+    const auto data     = reinterpret_cast<const char*>(embedded.data);
+
+    // A network embedded in the in-memory layout is used in place, it lives as long as
+    // the program, so the mapping is not owned
+    if (embedded.size >= sizeof(MappedNetMagic)
+        && std::memcmp(data, MappedNetMagic, sizeof(MappedNetMagic)) == 0)
+    {
+        auto description =
+          load_mapped(data, embedded.size, std::shared_ptr<const void>(data, [](const void*) {}));
+
+        if (description.has_value())
+        {
+            evalFile.current        = evalFile.defaultName;
+            evalFile.netDescription = description.value();
+        }
+        return;
+    }
 
     MemoryBuffer buffer(const_cast<char*>(reinterpret_cast<const char*>(embedded.data)),
                         size_t(embedded.size));
@@ -341,8 +762,11 @@ void Network<Arch, Transformer>::load_internal() {
 
 template<typename Arch, typename Transformer>
 void Network<Arch, Transformer>::initialize() {
-    featureTransformer = make_unique_large_page<Transformer>();
-    network            = make_unique_aligned<Arch[]>(LayerStacks);
+    mappedFile.reset();
+    transformerStorage = make_unique_large_page<Transformer>();
+    networkStorage     = make_unique_aligned<Arch[]>(LayerStacks);
+    featureTransformer = transformerStorage.get();
+    network            = networkStorage.get();
 }
 
 
@@ -366,6 +790,73 @@ std::optional<std::string> Network<Arch, Transformer>::load(std::istream& stream
 }
 
 
+// Maps a pre-transformed network file and points the network at it. The current
+// parameters are kept if the file does not match this build.
+template<typename Arch, typename Transformer>
+std::optional<std::string> Network<Arch, Transformer>::load_mapped(const std::string& path) {
+
+    size_t      size = 0;
+    const void* mem  = map_file(path, &size);
+
+    if (!mem)
+        return std::nullopt;
+
+    std::shared_ptr<const void> mapping(mem, [size](const void* m) { unmap_file(m, size); });
+
+    return load_mapped(static_cast<const char*>(mem), size, std::move(mapping));
+}
+
+
+// Points the network at pre-transformed parameters held by mapping. If they are not
+// aligned enough to be used in place, they are copied with a single memcpy instead.
+template<typename Arch, typename Transformer>
+std::optional<std::string> Network<Arch, Transformer>::load_mapped(
+  const char* data, size_t size, std::shared_ptr<const void> mapping) {
+    static_assert(std::is_trivially_copyable_v<Transformer> && std::is_trivially_copyable_v<Arch>,
+                  "The parameters must be usable from their raw bytes");
+
+    MappedNetHeader header;
+    if (size < sizeof(header))
+        return std::nullopt;
+
+    std::memcpy(&header, data, sizeof(header));
+
+    if (std::memcmp(header.magic, MappedNetMagic, sizeof(MappedNetMagic)) != 0
+        || header.hashValue != Network::hash || header.layerStacks != LayerStacks
+        || header.transformerSize != sizeof(Transformer) || header.archSize != sizeof(Arch)
+        || std::memcmp(header.layout, MappedNetLayout, sizeof(MappedNetLayout)) != 0
+        || header.descriptionSize > size)
+        return std::nullopt;
+
+    const std::size_t transformerOffset = align_mapped(sizeof(header) + header.descriptionSize);
+    const std::size_t networkOffset     = align_mapped(transformerOffset + sizeof(Transformer));
+
+    if (size != networkOffset + sizeof(Arch) * LayerStacks)
+        return std::nullopt;
+
+    constexpr std::size_t alignment = std::max(alignof(Transformer), alignof(Arch));
+
+    if (reinterpret_cast<std::uintptr_t>(data) % alignment != 0)
+    {
+        initialize();
+        std::memcpy(static_cast<void*>(transformerStorage.get()), data + transformerOffset,
+                    sizeof(Transformer));
+        std::memcpy(static_cast<void*>(networkStorage.get()), data + networkOffset,
+                    sizeof(Arch) * LayerStacks);
+    }
+    else
+    {
+        mappedFile         = std::move(mapping);
+        featureTransformer = reinterpret_cast<const Transformer*>(data + transformerOffset);
+        network            = reinterpret_cast<const Arch*>(data + networkOffset);
+        transformerStorage.reset();
+        networkStorage.reset();
+    }
+
+    return std::string(data + sizeof(header), header.descriptionSize);
+}
+
+
 // Read network header
 template<typename Arch, typename Transformer>
 bool Network<Arch, Transformer>::read_header(std::istream&  stream,
@@ -405,11 +896,11 @@ bool Network<Arch, Transformer>::read_parameters(std::istream& stream,
         return false;
     if (hashValue != Network::hash)
         return false;
-    if (!Detail::read_parameters(stream, *featureTransformer))
+    if (!Detail::read_parameters(stream, *transformerStorage))
         return false;
     for (std::size_t i = 0; i < LayerStacks; ++i)
     {
-        if (!Detail::read_parameters(stream, network[i]))
+        if (!Detail::read_parameters(stream, networkStorage[i]))
             return false;
     }
     return stream && stream.peek() == std::ios::traits_type::eof();
@@ -421,7 +912,19 @@ bool Network<Arch, Transformer>::write_parameters(std::ostream&      stream,
                                                   const std::string& netDescription) const {
     if (!write_header(stream, Network::hash, netDescription))
         return false;
-    if (!Detail::write_parameters(stream, *featureTransformer))
+
+    // The feature transformer is unpermuted in place while it is written, which
+    // a read-only mapping does not allow, so a mapped one is written from a copy.
+    LargePagePtr<Transformer> transformerCopy;
+    Transformer*              transformer = transformerStorage.get();
+
+    if (mappedFile)
+    {
+        transformerCopy = make_unique_large_page<Transformer>(*featureTransformer);
+        transformer     = transformerCopy.get();
+    }
+
+    if (!Detail::write_parameters(stream, *transformer))
         return false;
     for (std::size_t i = 0; i < LayerStacks; ++i)
     {
@@ -22,6 +22,7 @@
 #include <cstdint>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -66,17 +67,34 @@ class Network {
 
     void load(const std::string& rootDirectory, std::string evalfilePath);
     bool save(const std::optional<std::string>& filename) const;
+    bool save_mapped(const std::optional<std::string>& filename) const;
 
     NetworkOutput evaluate(const Position&                         pos,
                            AccumulatorStack&                       accumulatorStack,
                            AccumulatorCaches::Cache<FTDimensions>* cache) const;
 
+    void evaluate_batch(const Position* const*                  positions,
+                        size_t                                  count,
+                        AccumulatorStack&                       accumulatorStack,
+                        AccumulatorCaches::Cache<FTDimensions>* cache,
+                        NetworkOutput*                          outputs) const;
 
+
+    bool is_loaded(std::string evalfilePath) const;
     void verify(std::string evalfilePath, const std::function<void(std::string_view)>&) const;
     NnueEvalTrace trace_evaluate(const Position&                         pos,
                                  AccumulatorStack&                       accumulatorStack,
                                  AccumulatorCaches::Cache<FTDimensions>* cache) const;
 
+    void benchmark_stages(Position&                               pos,
+                          AccumulatorStack&                       accumulatorStack,
+                          AccumulatorCaches::Cache<FTDimensions>* cache,
+                          int                                     repetitions,
+                          NnueBenchmark&                          timings) const;
+
+    // Size of the large pages holding the feature transformer, 0 for default pages
+    size_t page_size() const { return large_page_size(transformerStorage.get()); }
+
    private:
     void load_user_net(const std::string&, const std::string&);
     void load_internal();
@@ -85,6 +103,8 @@ class Network {
 
     bool                       save(std::ostream&, const std::string&, const std::string&) const;
     std::optional<std::string> load(std::istream&);
+    std::optional<std::string> load_mapped(const std::string&);
+    std::optional<std::string> load_mapped(const char*, size_t, std::shared_ptr<const void>);
 
     bool read_header(std::istream&, std::uint32_t*, std::string*) const;
     bool write_header(std::ostream&, std::uint32_t, const std::string&) const;
@@ -93,10 +113,16 @@ class Network {
     bool write_parameters(std::ostream&, const std::string&) const;
 
     // Input feature converter
-    LargePagePtr<Transformer> featureTransformer;
+    const Transformer* featureTransformer = nullptr;
 
     // Evaluation function
-    AlignedPtr<Arch[]> network;
+    const Arch* network = nullptr;
+
+    // The parameters are either owned, or read in place from a memory-mapped
+    // pre-transformed network file, which is shared by all copies of the network.
+    LargePagePtr<Transformer>   transformerStorage;
+    AlignedPtr<Arch[]>          networkStorage;
+    std::shared_ptr<const void> mappedFile;
 
     EvalFile         evalFile;
     EmbeddedNNUEType embeddedType;
@@ -18,9 +18,13 @@
 
 #include "nnue_accumulator.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <iomanip>
 #include <initializer_list>
+#include <ostream>
+#include <sstream>
 #include <type_traits>
 
 #include "../bitboard.h"
@@ -55,20 +59,72 @@ template<Color Perspective, IndexType Dimensions>
 void update_accumulator_refresh_cache(const FeatureTransformer<Dimensions>& featureTransformer,
                                       const Position&                       pos,
                                       AccumulatorState&                     accumulatorState,
-                                      AccumulatorCaches::Cache<Dimensions>& cache);
+                                      AccumulatorCaches::Cache<Dimensions>& cache,
+                                      NnueStats&                            stats);
 
 }
 
 void AccumulatorState::reset(const DirtyPiece& dp) noexcept {
     dirtyPiece = dp;
-    accumulatorBig.computed.fill(false);
-    accumulatorSmall.computed.fill(false);
+    invalidate();
+}
+
+void AccumulatorState::invalidate() noexcept {
+    if (accumulatorBig)
+        accumulatorBig->computed.fill(false);
+    if (accumulatorSmall)
+        accumulatorSmall->computed.fill(false);
 }
 
 const AccumulatorState& AccumulatorStack::latest() const noexcept { return accumulators[size - 1]; }
 
 AccumulatorState& AccumulatorStack::mut_latest() noexcept { return accumulators[size - 1]; }
 
+// Allocates the rings of the networks in use, but not that of the big net when only the
+// small net is used. The new accumulators are value-initialized, so none is marked as
+// computed.
+void AccumulatorStack::allocate(bool smallNetOnly) {
+
+    if (!accumulatorsSmall)
+        accumulatorsSmall =
+          make_unique_aligned<Accumulator<TransformedFeatureDimensionsSmall>[]>(ringSize);
+
+    if (smallNetOnly)
+        accumulatorsBig.reset();
+    else if (!accumulatorsBig)
+        accumulatorsBig =
+          make_unique_aligned<Accumulator<TransformedFeatureDimensionsBig>[]>(ringSize);
+
+    for (std::size_t i = 0; i < accumulators.size(); ++i)
+    {
+        const std::size_t slot = i % ringSize;
+
+        accumulators[i].accumulatorBig   = accumulatorsBig ? &accumulatorsBig[slot] : nullptr;
+        accumulators[i].accumulatorSmall = &accumulatorsSmall[slot];
+    }
+}
+
+// Grows the rings to the depth reached so far, in chunks of AccumulatorChunkSize plies.
+// It allocates, so the search calls it at the root between two iterations, and never
+// from evaluate(), which is noexcept.
+void AccumulatorStack::grow() {
+    assert(size == 1);
+
+    const std::size_t plies = std::min(
+      (maxSize + AccumulatorChunkSize - 1) / AccumulatorChunkSize * AccumulatorChunkSize,
+      accumulators.size());
+
+    if (plies <= ringSize)
+        return;
+
+    const bool smallNetOnly = !accumulatorsBig;
+
+    accumulatorsBig.reset();
+    accumulatorsSmall.reset();
+    ringSize = plies;
+    allocate(smallNetOnly);
+}
+
 void AccumulatorStack::reset() noexcept {
     accumulators[0].reset({});
     size = 1;
@@ -78,11 +134,64 @@ void AccumulatorStack::push(const DirtyPiece& dirtyPiece) noexcept {
     assert(size + 1 < accumulators.size());
     accumulators[size].reset(dirtyPiece);
     size++;
+    maxSize = std::max(maxSize, size);
 }
 
 void AccumulatorStack::pop() noexcept {
     assert(size > 1);
     size--;
+
+    // The slot of the popped ply is also that of the ply ringSize below, if any, which
+    // is on the stack and must not use the accumulators of the popped ply
+    if (size >= ringSize)
+        accumulators[size].invalidate();
+}
+
+NnueStats& NnueStats::operator+=(const NnueStats& s) {
+    upToDate += s.upToDate;
+    forwardUpdates += s.forwardUpdates;
+    forwardPlies += s.forwardPlies;
+    refreshes += s.refreshes;
+    backwardPlies += s.backwardPlies;
+    refreshAdded += s.refreshAdded;
+    refreshRemoved += s.refreshRemoved;
+    bigNetEvals += s.bigNetEvals;
+    smallNetEvals += s.smallNetEvals;
+    smallNetRejects += s.smallNetRejects;
+    return *this;
+}
+
+std::ostream& operator<<(std::ostream& os, [[maybe_unused]] const NnueStats& s) {
+#ifndef NNUE_STATS
+    return os << "NNUE statistics are not available, build with nnuestats=yes";
+#else
+    auto average = [](std::uint64_t n, std::uint64_t total) {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(2) << (total ? double(n) / total : 0.0);
+        return ss.str();
+    };
+
+    const std::uint64_t updates = s.upToDate + s.forwardUpdates + s.refreshes;
+
+    os << "Accumulator updates        : " << updates
+       << "\n    already computed       : " << s.upToDate << " (" << percent(s.upToDate, updates)
+       << ")"
+       << "\n    forward incremental    : " << s.forwardUpdates << " ("
+       << percent(s.forwardUpdates, updates) << "), "
+       << average(s.forwardPlies, s.forwardUpdates) << " plies"
+       << "\n    refresh and backward   : " << s.refreshes << " ("
+       << percent(s.refreshes, updates) << "), " << average(s.backwardPlies, s.refreshes)
+       << " plies"
+       << "\nPieces added per refresh   : " << average(s.refreshAdded, s.refreshes)
+       << "\nPieces removed per refresh : " << average(s.refreshRemoved, s.refreshes)
+       << "\nNetwork evaluations        : " << s.bigNetEvals + s.smallNetEvals
+       << "\n    big net                : " << s.bigNetEvals
+       << "\n    small net              : " << s.smallNetEvals
+       << "\n    small net overridden   : " << s.smallNetRejects << " ("
+       << percent(s.smallNetRejects, s.smallNetEvals) << " of small)";
+
+    return os;
+#endif
 }
 
 template<IndexType Dimensions>
@@ -100,13 +209,20 @@ void AccumulatorStack::evaluate_side(const Position&                       pos,
                                      AccumulatorCaches::Cache<Dimensions>& cache) noexcept {
 
     const auto last_usable_accum = find_last_usable_accumulator<Perspective, Dimensions>();
+    const auto plies             = size - 1 - last_usable_accum;
 
     if ((accumulators[last_usable_accum].template acc<Dimensions>()).computed[Perspective])
+    {
+        stats.add(plies ? &NnueStats::forwardUpdates : &NnueStats::upToDate);
+        stats.add(&NnueStats::forwardPlies, plies);
         forward_update_incremental<Perspective>(pos, featureTransformer, last_usable_accum);
-
+    }
     else
     {
-        update_accumulator_refresh_cache<Perspective>(featureTransformer, pos, mut_latest(), cache);
+        stats.add(&NnueStats::refreshes);
+        stats.add(&NnueStats::backwardPlies, plies);
+        update_accumulator_refresh_cache<Perspective>(featureTransformer, pos, mut_latest(), cache,
+                                                      stats);
         backward_update_incremental<Perspective>(pos, featureTransformer, last_usable_accum);
     }
 }
@@ -116,7 +232,10 @@ void AccumulatorStack::evaluate_side(const Position&                       pos,
 template<Color Perspective, IndexType Dimensions>
 std::size_t AccumulatorStack::find_last_usable_accumulator() const noexcept {
 
-    for (std::size_t curr_idx = size - 1; curr_idx > 0; curr_idx--)
+    // The plies further down share their slots with the ones above
+    const std::size_t lowest = size > ringSize ? size - ringSize : 0;
+
+    for (std::size_t curr_idx = size - 1; curr_idx > lowest; curr_idx--)
     {
         if ((accumulators[curr_idx].template acc<Dimensions>()).computed[Perspective])
             return curr_idx;
@@ -125,7 +244,7 @@ std::size_t AccumulatorStack::find_last_usable_accumulator() const noexcept {
             return curr_idx;
     }
 
-    return 0;
+    return lowest;
 }
 
 template<Color Perspective, IndexType Dimensions>
@@ -366,7 +485,8 @@ template<Color Perspective, IndexType Dimensions>
 void update_accumulator_refresh_cache(const FeatureTransformer<Dimensions>& featureTransformer,
                                       const Position&                       pos,
                                       AccumulatorState&                     accumulatorState,
-                                      AccumulatorCaches::Cache<Dimensions>& cache) {
+                                      AccumulatorCaches::Cache<Dimensions>& cache,
+                                      NnueStats&                            stats) {
 
     using Tiling [[maybe_unused]] = SIMDTiling<Dimensions, Dimensions, PSQTBuckets>;
 
@@ -397,6 +517,9 @@ void update_accumulator_refresh_cache(const FeatureTransformer<Dimensions>& feat
         }
     }
 
+    stats.add(&NnueStats::refreshAdded, added.size());
+    stats.add(&NnueStats::refreshRemoved, removed.size());
+
     auto& accumulator                 = accumulatorState.acc<Dimensions>();
     accumulator.computed[Perspective] = true;
 
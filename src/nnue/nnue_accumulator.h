@@ -25,8 +25,11 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <iosfwd>
 #include <vector>
 
+#include "../memory.h"
+#include "../misc.h"
 #include "../types.h"
 #include "nnue_architecture.h"
 #include "nnue_common.h"
@@ -61,8 +64,8 @@ struct alignas(CacheLineSize) Accumulator {
 struct AccumulatorCaches {
 
     template<typename Networks>
-    AccumulatorCaches(const Networks& networks) {
-        clear(networks);
+    AccumulatorCaches(const Networks& networks, bool smallNetOnly = false) {
+        clear(networks, smallNetOnly);
     }
 
     template<IndexType Size>
@@ -96,21 +99,38 @@ struct AccumulatorCaches {
         std::array<std::array<Entry, COLOR_NB>, SQUARE_NB> entries;
     };
 
+    // When only the small net is used, with the SmallNetOnly option, the cache of
+    // the big net is not allocated.
     template<typename Networks>
-    void clear(const Networks& networks) {
-        big.clear(networks.big);
+    void clear(const Networks& networks, bool smallNetOnly = false) {
+        if (smallNetOnly)
+            big.reset();
+        else
+        {
+            if (!big)
+                big = make_unique_aligned<Cache<TransformedFeatureDimensionsBig>>();
+
+            big->clear(networks.big);
+        }
+
         small.clear(networks.small);
     }
 
-    Cache<TransformedFeatureDimensionsBig>   big;
-    Cache<TransformedFeatureDimensionsSmall> small;
+    bool small_net_only() const { return !big; }
+
+    std::size_t memory_usage() const { return sizeof(*this) + (big ? sizeof(*big) : 0); }
+
+    AlignedPtr<Cache<TransformedFeatureDimensionsBig>> big;
+    Cache<TransformedFeatureDimensionsSmall>           small;
 };
 
 
+// The DirtyPiece of a ply and its accumulators, which are slots of the rings of the
+// AccumulatorStack. The big one is null when only the small net is used.
 struct AccumulatorState {
-    Accumulator<TransformedFeatureDimensionsBig>   accumulatorBig;
-    Accumulator<TransformedFeatureDimensionsSmall> accumulatorSmall;
-    DirtyPiece                                     dirtyPiece;
+    Accumulator<TransformedFeatureDimensionsBig>*   accumulatorBig   = nullptr;
+    Accumulator<TransformedFeatureDimensionsSmall>* accumulatorSmall = nullptr;
+    DirtyPiece                                      dirtyPiece;
 
     template<IndexType Size>
     auto& acc() noexcept {
@@ -119,9 +139,9 @@ struct AccumulatorState {
                       "Invalid size for accumulator");
 
         if constexpr (Size == TransformedFeatureDimensionsBig)
-            return accumulatorBig;
+            return *accumulatorBig;
         else if constexpr (Size == TransformedFeatureDimensionsSmall)
-            return accumulatorSmall;
+            return *accumulatorSmall;
     }
 
     template<IndexType Size>
@@ -131,32 +151,86 @@ struct AccumulatorState {
                       "Invalid size for accumulator");
 
         if constexpr (Size == TransformedFeatureDimensionsBig)
-            return accumulatorBig;
+            return *accumulatorBig;
         else if constexpr (Size == TransformedFeatureDimensionsSmall)
-            return accumulatorSmall;
+            return *accumulatorSmall;
     }
 
     void reset(const DirtyPiece& dp) noexcept;
+    void invalidate() noexcept;
 };
 
 
+// Counters of the accumulator updates of one search thread, each perspective counted
+// apart, and of the networks run by Eval::evaluate(). They are only updated in builds
+// with `make nnuestats=yes`.
+struct NnueStats {
+    StatCounter upToDate;         // Accumulators already computed
+    StatCounter forwardUpdates;   // Incremental updates from a computed ancestor
+    StatCounter forwardPlies;
+    StatCounter refreshes;        // Refreshes from the cache, then backward updates
+    StatCounter backwardPlies;
+    StatCounter refreshAdded;     // Pieces added to the cache entry by the refreshes
+    StatCounter refreshRemoved;
+    StatCounter bigNetEvals;
+    StatCounter smallNetEvals;
+    StatCounter smallNetRejects;  // Small net evaluations overridden by the big net
+
+    void add([[maybe_unused]] StatCounter NnueStats::* counter,
+             [[maybe_unused]] std::uint64_t            n = 1) {
+#ifdef NNUE_STATS
+        this->*counter += n;
+#endif
+    }
+
+    NnueStats& operator+=(const NnueStats& s);
+};
+
+std::ostream& operator<<(std::ostream& os, const NnueStats& s);
+
+// The stack keeps the complete DirtyPiece history of the searched line, but the
+// accumulators, about 12 KiB per ply for the big net, are kept in rings of ringSize
+// slots, ply i using slot i % ringSize. The search grows the rings to the depth it has
+// reached between its iterations, with grow(), so that a worker holds accumulators for
+// the depth it actually searches, and none for the big net when it is not used. Until
+// then the plies beyond the ring reuse the slots of the plies ringSize below, whose
+// accumulators are recomputed when they are needed again.
+constexpr std::size_t AccumulatorChunkSize = 8;
+
 class AccumulatorStack {
    public:
     AccumulatorStack() :
         accumulators(MAX_PLY + 1),
-        size{1} {}
+        size{1},
+        maxSize{1},
+        ringSize{AccumulatorChunkSize} {
+        allocate(false);
+    }
 
     [[nodiscard]] const AccumulatorState& latest() const noexcept;
 
+    void allocate(bool smallNetOnly);
+    void grow();
     void reset() noexcept;
     void push(const DirtyPiece& dirtyPiece) noexcept;
     void pop() noexcept;
 
+    std::size_t memory_usage() const {
+        const std::size_t perPly =
+          sizeof(Accumulator<TransformedFeatureDimensionsSmall>)
+          + (accumulatorsBig ? sizeof(Accumulator<TransformedFeatureDimensionsBig>) : 0);
+
+        return sizeof(*this) + accumulators.size() * sizeof(AccumulatorState)
+             + ringSize * perPly;
+    }
+
     template<IndexType Dimensions>
     void evaluate(const Position&                       pos,
                   const FeatureTransformer<Dimensions>& featureTransformer,
                   AccumulatorCaches::Cache<Dimensions>& cache) noexcept;
 
+    NnueStats stats;
+
    private:
     [[nodiscard]] AccumulatorState& mut_latest() noexcept;
 
@@ -178,8 +252,10 @@ class AccumulatorStack {
                                      const FeatureTransformer<Dimensions>& featureTransformer,
                                      const std::size_t                     end) noexcept;
 
-    std::vector<AccumulatorState> accumulators;
-    std::size_t                   size;
+    std::vector<AccumulatorState>                                accumulators;
+    AlignedPtr<Accumulator<TransformedFeatureDimensionsBig>[]>   accumulatorsBig;
+    AlignedPtr<Accumulator<TransformedFeatureDimensionsSmall>[]> accumulatorsSmall;
+    std::size_t                                                  size, maxSize, ringSize;
 };
 
 }  // namespace Stockfish::Eval::NNUE
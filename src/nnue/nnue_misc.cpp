@@ -20,15 +20,19 @@
 
 #include "nnue_misc.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iomanip>
 #include <iosfwd>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string_view>
 #include <tuple>
+#include <vector>
 
 #include "../position.h"
 #include "../types.h"
@@ -124,7 +128,7 @@ trace(Position& pos, const Eval::NNUE::Networks& networks, Eval::NNUE::Accumulat
 
     // We estimate the value of each piece by doing a differential evaluation from
     // the current base eval, simulating the removal of the piece from its square.
-    auto [psqt, positional] = networks.big.evaluate(pos, accumulators, &caches.big);
+    auto [psqt, positional] = networks.big.evaluate(pos, accumulators, caches.big.get());
     Value base              = psqt + positional;
     base                    = pos.side_to_move() == WHITE ? base : -base;
 
@@ -140,10 +144,11 @@ trace(Position& pos, const Eval::NNUE::Networks& networks, Eval::NNUE::Accumulat
                 pos.remove_piece(sq);
 
                 accumulators.reset();
-                std::tie(psqt, positional) = networks.big.evaluate(pos, accumulators, &caches.big);
-                Value eval                 = psqt + positional;
-                eval                       = pos.side_to_move() == WHITE ? eval : -eval;
-                v                          = base - eval;
+                std::tie(psqt, positional) =
+                  networks.big.evaluate(pos, accumulators, caches.big.get());
+                Value eval = psqt + positional;
+                eval       = pos.side_to_move() == WHITE ? eval : -eval;
+                v          = base - eval;
 
                 pos.put_piece(pc, sq);
             }
@@ -157,7 +162,7 @@ trace(Position& pos, const Eval::NNUE::Networks& networks, Eval::NNUE::Accumulat
     ss << '\n';
 
     accumulators.reset();
-    auto t = networks.big.trace_evaluate(pos, accumulators, &caches.big);
+    auto t = networks.big.trace_evaluate(pos, accumulators, caches.big.get());
 
     ss << " NNUE network contributions "
        << (pos.side_to_move() == WHITE ? "(White to move)" : "(Black to move)") << std::endl
@@ -190,4 +195,59 @@ trace(Position& pos, const Eval::NNUE::Networks& networks, Eval::NNUE::Accumulat
 }
 
 
+// Times each stage of the big and the small network on the positions reached from the
+// given ones, and returns a table of the time per call and of the rate at which the stage
+// goes through its parameters and activations.
+std::string
+benchmark(const std::vector<std::string>& fens, const Networks& networks, int repetitions) {
+
+    constexpr const char* StageNames[STAGE_NB] = {
+      "Refresh (Finny table)", "Incremental update", "Feature transform", "fc_0 (sparse input)",
+      "ac_sqr_0 (SqrClippedReLU)", "ac_0 (ClippedReLU)", "fc_1", "ac_1 (ClippedReLU)", "fc_2",
+      "Full evaluation"};
+
+    auto             caches = std::make_unique<AccumulatorCaches>(networks);
+    AccumulatorStack accumulators;
+    NnueBenchmark    big{}, small{};
+
+    for (const auto& fen : fens)
+    {
+        StateInfo st;
+        Position  pos;
+
+        pos.set(fen, false, &st);
+        networks.big.benchmark_stages(pos, accumulators, caches->big.get(), repetitions, big);
+        networks.small.benchmark_stages(pos, accumulators, &caches->small, repetitions, small);
+    }
+
+    std::stringstream ss;
+
+    auto table = [&](const char* name, IndexType dimensions, const NnueBenchmark& timings) {
+        ss << " NNUE stage benchmark, " << name << " network (" << dimensions << ")\n"
+           << "+---------------------------+--------------+------------+------------+\n"
+           << "|           Stage           |    Calls     |  ns/call   |    GB/s    |\n"
+           << "+---------------------------+--------------+------------+------------+\n";
+
+        for (int stage = 0; stage < STAGE_NB; ++stage)
+        {
+            const auto& t  = timings[stage];
+            const auto  ns = std::max<std::uint64_t>(t.nanoseconds, 1);
+
+            ss << "| " << std::left << std::setw(25) << StageNames[stage] << std::right
+               << " | " << std::setw(12) << t.calls << " | " << std::fixed << std::setprecision(1)
+               << std::setw(10) << double(ns) / std::max<std::uint64_t>(t.calls, 1) << " | "
+               << std::setprecision(2) << std::setw(10) << double(t.bytes) / ns << " |\n";
+        }
+
+        ss << "+---------------------------+--------------+------------+------------+\n";
+    };
+
+    table("big", TransformedFeatureDimensionsBig, big);
+    ss << '\n';
+    table("small", TransformedFeatureDimensionsSmall, small);
+
+    return ss.str();
+}
+
+
 }  // namespace Stockfish::Eval::NNUE
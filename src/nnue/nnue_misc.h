@@ -19,8 +19,11 @@
 #ifndef NNUE_MISC_H_INCLUDED
 #define NNUE_MISC_H_INCLUDED
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include "../types.h"
 #include "nnue_architecture.h"
@@ -50,10 +53,35 @@ struct NnueEvalTrace {
     std::size_t correctBucket;
 };
 
+// Stages of the evaluation timed by the nnue benchmark, in the order they run
+enum NnueStage {
+    STAGE_REFRESH,
+    STAGE_UPDATE,
+    STAGE_TRANSFORM,
+    STAGE_FC_0,
+    STAGE_AC_SQR_0,
+    STAGE_AC_0,
+    STAGE_FC_1,
+    STAGE_AC_1,
+    STAGE_FC_2,
+    STAGE_EVALUATE,
+    STAGE_NB
+};
+
+struct NnueStageTiming {
+    std::uint64_t calls;
+    std::uint64_t nanoseconds;
+    std::uint64_t bytes;  // Parameters and activations touched by all the calls
+};
+
+using NnueBenchmark = std::array<NnueStageTiming, STAGE_NB>;
+
 struct Networks;
 struct AccumulatorCaches;
 
 std::string trace(Position& pos, const Networks& networks, AccumulatorCaches& caches);
+std::string
+benchmark(const std::vector<std::string>& fens, const Networks& networks, int repetitions);
 
 }  // namespace Stockfish::Eval::NNUE
 }  // namespace Stockfish
@@ -1207,6 +1207,34 @@ class LazyNumaReplicated: public NumaReplicatedBase {
         prepare_replicate_from(std::move(*source));
     }
 
+    using Replicas = std::vector<std::unique_ptr<T>>;
+
+    // Copies the source to every NUMA node without touching the current instances,
+    // so that it can run on another thread while they are in use, until replace().
+    Replicas replicate(T&& source) const {
+        Replicas replicas;
+
+        const NumaConfig& cfg = get_numa_config();
+        if (cfg.requires_memory_replication())
+        {
+            for (NumaIndex n = 0; n < cfg.num_numa_nodes(); ++n)
+                cfg.execute_on_numa_node(n, [&replicas, &source]() {
+                    replicas.emplace_back(std::make_unique<T>(source));
+                });
+        }
+        else
+            replicas.emplace_back(std::make_unique<T>(std::move(source)));
+
+        return replicas;
+    }
+
+    // Installs the copies made by replicate(), which must have the same NUMA config
+    void replace(Replicas&& replicas) {
+        assert(replicas.size() == instances.size());
+
+        instances = std::move(replicas);
+    }
+
     void on_numa_config_changed() override {
         // Use the first one as the source. It doesn't matter which one we use,
         // because they all must be identical, but the first one is guaranteed to exist.
@@ -682,6 +682,47 @@ bool Position::gives_check(Move m) const {
 }
 
 
+// Computes the hash key of the position after the given move without making it.
+// The en passant square a double push may set is not accounted for, so the result
+// is only a hint, used by the search to look the position up in its SearchingTable.
+Key Position::key_after(Move m) const {
+
+    const Color  us       = sideToMove;
+    const Square from     = m.from_sq();
+    Square       to       = m.to_sq();
+    const Piece  pc       = piece_on(from);
+    Piece        captured = m.type_of() == EN_PASSANT ? make_piece(~us, PAWN) : piece_on(to);
+
+    Key k = st->key ^ Zobrist::side;
+
+    if (m.type_of() == CASTLING)
+    {
+        // Castling is encoded as 'king captures the rook'
+        const bool   kingSide = to > from;
+        const Square rto      = relative_square(us, kingSide ? SQ_F1 : SQ_D1);
+
+        k ^= Zobrist::psq[captured][to] ^ Zobrist::psq[captured][rto];
+        to       = relative_square(us, kingSide ? SQ_G1 : SQ_C1);
+        captured = NO_PIECE;
+    }
+    else if (captured)
+        k ^= Zobrist::psq[captured][m.type_of() == EN_PASSANT ? to - pawn_push(us) : to];
+
+    const Piece moved = m.type_of() == PROMOTION ? make_piece(us, m.promotion_type()) : pc;
+
+    k ^= Zobrist::psq[pc][from] ^ Zobrist::psq[moved][to];
+
+    if (st->epSquare != SQ_NONE)
+        k ^= Zobrist::enpassant[file_of(st->epSquare)];
+
+    if (st->castlingRights && (castlingRightsMask[from] | castlingRightsMask[to]))
+        k ^= Zobrist::castling[st->castlingRights]
+           ^ Zobrist::castling[st->castlingRights
+                               & ~(castlingRightsMask[from] | castlingRightsMask[to])];
+
+    return captured || type_of(pc) == PAWN ? k : adjust_key50<true>(k);
+}
+
 // Makes a move, and saves all information necessary
 // to a StateInfo object. The move is assumed to be legal. Pseudo-legal
 // moves should be filtered out before this function is called.
@@ -31,6 +31,7 @@
 #include <list>
 #include <ratio>
 #include <string>
+#include <thread>
 #include <utility>
 
 #include "bitboard.h"
@@ -66,6 +67,25 @@ namespace {
 constexpr int SEARCHEDLIST_CAPACITY = 32;
 using SearchedList                  = ValueList<Move, SEARCHEDLIST_CAPACITY>;
 
+constexpr int MaxDeferredMoves = 16;
+
+// With SplitMultiPV all the lines are searched by every thread up to this depth
+constexpr Depth SplitMultiPVMinDepth = 4;
+
+// With DeterministicSearch the threads synchronize every time they have searched this
+// many nodes. The TT write buffers keep the positions written in between.
+constexpr uint64_t QuantumNodes    = 8192;
+constexpr size_t   TTBufferEntries = 4 * QuantumNodes;
+
+// Holds the SearchingTable entry of a node for the duration of its move loop
+struct SearchingMark {
+    SearchingMark(SearchingTable& table, bool mark, Key key, Depth depth, size_t threadIdx) :
+        entry(mark ? table.enter(key, depth, threadIdx) : nullptr) {}
+    ~SearchingMark() { SearchingTable::leave(entry); }
+
+    SearchingTable::Entry* entry;
+};
+
 // (*Scalers):
 // The values with Scaler asterisks have proven non-linear scaling.
 // They are optimized to time controls of 180 + 1.8 and longer,
@@ -75,10 +95,11 @@ using SearchedList                  = ValueList<Move, SEARCHEDLIST_CAPACITY>;
 int correction_value(const Worker& w, const Position& pos, const Stack* const ss) {
     const Color us    = pos.side_to_move();
     const auto  m     = (ss - 1)->currentMove;
-    const auto  pcv   = w.pawnCorrectionHistory[pawn_structure_index<Correction>(pos)][us];
-    const auto  micv  = w.minorPieceCorrectionHistory[minor_piece_index(pos)][us];
-    const auto  wnpcv = w.nonPawnCorrectionHistory[non_pawn_index<WHITE>(pos)][WHITE][us];
-    const auto  bnpcv = w.nonPawnCorrectionHistory[non_pawn_index<BLACK>(pos)][BLACK][us];
+    const auto& h     = *w.histories;
+    const auto  pcv   = h.pawnCorrectionHistory[pawn_structure_index<Correction>(pos)][us];
+    const auto  micv  = h.minorPieceCorrectionHistory[minor_piece_index(pos)][us];
+    const auto  wnpcv = h.nonPawnCorrectionHistory[non_pawn_index<WHITE>(pos)][WHITE][us];
+    const auto  bnpcv = h.nonPawnCorrectionHistory[non_pawn_index<BLACK>(pos)][BLACK][us];
     const auto  cntcv =
       m.is_ok() ? (*(ss - 2)->continuationCorrectionHistory)[pos.piece_on(m.to_sq())][m.to_sq()]
                  : 0;
@@ -101,12 +122,13 @@ void update_correction_history(const Position& pos,
 
     static constexpr int nonPawnWeight = 172;
 
-    workerThread.pawnCorrectionHistory[pawn_structure_index<Correction>(pos)][us]
-      << bonus * 111 / 128;
-    workerThread.minorPieceCorrectionHistory[minor_piece_index(pos)][us] << bonus * 151 / 128;
-    workerThread.nonPawnCorrectionHistory[non_pawn_index<WHITE>(pos)][WHITE][us]
+    KeyedHistories& h = *workerThread.histories;
+
+    h.pawnCorrectionHistory[pawn_structure_index<Correction>(pos)][us] << bonus * 111 / 128;
+    h.minorPieceCorrectionHistory[minor_piece_index(pos)][us] << bonus * 151 / 128;
+    h.nonPawnCorrectionHistory[non_pawn_index<WHITE>(pos)][WHITE][us]
       << bonus * nonPawnWeight / 128;
-    workerThread.nonPawnCorrectionHistory[non_pawn_index<BLACK>(pos)][BLACK][us]
+    h.nonPawnCorrectionHistory[non_pawn_index<BLACK>(pos)][BLACK][us]
       << bonus * nonPawnWeight / 128;
 
     if (m.is_ok())
@@ -146,25 +168,87 @@ Search::Worker::Worker(SharedState&                    sharedState,
     options(sharedState.options),
     threads(sharedState.threads),
     tt(sharedState.tt),
+    searchingTable(sharedState.searchingTable),
     networks(sharedState.networks),
+    sharedHistories(sharedState.sharedHistories),
     refreshTable(networks[token]) {
+    // Workers are created by their own thread
+    ttThreadIndex = threadIdx;
+#ifdef TT_STATS
+    ttThreadStats = &ttStats;
+#endif
+
+    // The threads are distributed among the NUMA nodes before they are created. When
+    // they are not bound, they all use the copy of the first node.
+    const auto& bound     = threads.get_bound_numa_nodes();
+    clearsSharedHistories = bound.empty()
+                            ? threadIdx == 0
+                            : std::find(bound.begin(), bound.end(), bound[threadIdx])
+                                == bound.begin() + threadIdx;
+
+    histories = &ownHistories;
+
     clear();
 }
 
+// Bytes of the accumulators and accumulator caches of the worker
+size_t Search::Worker::nnue_memory_usage() const {
+    return accumulatorStack.memory_usage() + refreshTable.memory_usage();
+}
+
 void Search::Worker::ensure_network_replicated() {
     // Access once to force lazy initialization.
     // We do this because we want to avoid initialization during search.
     (void) (networks[numaAccessToken]);
 }
 
+// Called by ThreadPool::start_thinking() in the thread itself, so that the cache is on its
+// NUMA node, and before the search starts, so that the pointer does not change while the
+// UCI thread reads the statistics.
+void Search::Worker::prepare_eval_cache() {
+
+    if (!options["EvalCache"])
+        evalCache.reset();
+    else if (!evalCache)
+    {
+        evalCache = std::make_unique<Eval::EvalCache>();
+        evalCache->clear();
+    }
+}
+
 void Search::Worker::start_searching() {
 
     accumulatorStack.reset();
 
+    // A single thread is deterministic anyway
+    deterministic  = options["DeterministicSearch"] && threads.size() > 1;
+    deferBusyMoves = options["DeferBusyMoves"] && threads.size() > 1 && !deterministic;
+
+    // The updates of the shared histories are racy, so a deterministic search uses
+    // those of the thread
+    histories = &ownHistories;
+    if (options["SharedHistories"] && !deterministic)
+        if (KeyedHistories* shared = sharedHistories[numaAccessToken].racy_tables())
+            histories = shared;
+
+    if (deterministic)
+    {
+        ttBuffer.resize(TTBufferEntries);
+        nextSync.store(QuantumNodes, std::memory_order_relaxed);
+    }
+
+    ttThreadBuffer = deterministic ? &ttBuffer : nullptr;
+
     // Non-main threads go directly to iterative_deepening()
     if (!is_mainthread())
     {
         iterative_deepening();
+
+        if (deterministic)
+            threads.quantumBarrier.leave(
+              false, [this](bool stopRequested) { complete_quantum(stopRequested); });
+
+        ttThreadBuffer = nullptr;
         return;
     }
 
@@ -172,6 +256,8 @@ void Search::Worker::start_searching() {
                             main_manager()->originalTimeAdjust);
     tt.new_search();
 
+    bool stopAtSync = false;
+
     if (rootMoves.empty())
     {
         rootMoves.emplace_back(Move::none());
@@ -182,6 +268,15 @@ void Search::Worker::start_searching() {
     {
         threads.start_searching();  // start non-main threads
         iterative_deepening();      // main thread start searching
+
+        // In a deterministic search the other threads are stopped at their next
+        // synchronization, so that they all stop after the same number of nodes.
+        if (deterministic)
+        {
+            stopAtSync = !main_manager()->ponder && !limits.infinite;
+            threads.quantumBarrier.leave(
+              stopAtSync, [this](bool stopRequested) { complete_quantum(stopRequested); });
+        }
     }
 
     // When we reach the maximum depth, we can arrive here without a raise of
@@ -194,11 +289,18 @@ void Search::Worker::start_searching() {
 
     // Stop the threads if not already stopped (also raise the stop if
     // "ponderhit" just reset threads.ponder)
-    threads.stop = true;
+    if (!stopAtSync)
+        threads.stop = true;
 
     // Wait until all threads have finished
     threads.wait_for_search_finished();
 
+    // Apply the writes made after the last synchronization
+    if (deterministic)
+        apply_tt_buffers();
+
+    ttThreadBuffer = nullptr;
+
     // When playing in 'nodes as time' mode, subtract the searched nodes from
     // the available ones before exiting.
     if (limits.npmsec)
@@ -286,6 +388,13 @@ void Search::Worker::iterative_deepening() {
 
     multiPV = std::min(multiPV, rootMoves.size());
 
+    // With SplitMultiPV each group of threads searches only the PV lines whose
+    // index modulo the number of groups is its own, and imports the others.
+    pvGroups = options["SplitMultiPV"] && multiPV > 1 && !deterministic
+               ? std::min(multiPV, threads.size())
+               : 1;
+    pvGroup  = threadIdx % pvGroups;
+
     int searchAgainCounter = 0;
 
     lowPlyHistory.fill(86);
@@ -298,6 +407,9 @@ void Search::Worker::iterative_deepening() {
         if (mainThread)
             totBestMoveChanges /= 2;
 
+        // Between two iterations, the accumulators can grow to the depth reached so far
+        accumulatorStack.grow();
+
         // Save the last iteration's scores before the first PV line is searched and
         // all the move scores except the (new) PV are set to -VALUE_INFINITE.
         for (RootMove& rm : rootMoves)
@@ -320,6 +432,31 @@ void Search::Worker::iterative_deepening() {
                         break;
             }
 
+            // Lines of other groups are taken from the board once the first iterations
+            // have ranked the root moves. A line is still searched here if its move is
+            // already on an earlier line, as happens when the ranking changes.
+            if (pvIdx % pvGroups != pvGroup && rootDepth > SplitMultiPVMinDepth)
+            {
+                // The main thread waits for the line of this depth, so that the
+                // output and a depth limit cover all the lines.
+                while (mainThread && !threads.stop
+                       && !threads.multiPVBoard.wait_for(pvIdx, rootDepth))
+                    main_manager()->check_time(*this);
+
+                if (threads.stop)
+                    break;
+
+                if (import_pv_line(pvIdx))
+                {
+                    std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
+
+                    if (mainThread && pvIdx + 1 == multiPV)
+                        main_manager()->pv(*this, threads, tt, rootDepth);
+
+                    continue;
+                }
+            }
+
             // Reset UCI info selDepth for each depth and each PV line
             selDepth = 0;
 
@@ -391,6 +528,9 @@ void Search::Worker::iterative_deepening() {
                 assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
             }
 
+            if (pvGroups > 1 && !threads.stop)
+                threads.multiPVBoard.publish(pvIdx, rootDepth, rootMoves[pvIdx]);
+
             // Sort the PV lines searched so far and update the GUI
             std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
@@ -439,7 +579,14 @@ void Search::Worker::iterative_deepening() {
                 || (rootMoves[0].score != -VALUE_INFINITE
                     && rootMoves[0].score <= VALUE_MATED_IN_MAX_PLY
                     && VALUE_MATE + rootMoves[0].score <= 2 * limits.mate)))
+        {
+            // In a deterministic search the other threads are stopped at their next
+            // synchronization, see start_searching()
+            if (deterministic)
+                break;
+
             threads.stop = true;
+        }
 
         // If the skill level is enabled and time is up, pick a sub-optimal best move
         if (skill.enabled() && skill.time_to_pick(rootDepth))
@@ -516,14 +663,37 @@ void Search::Worker::iterative_deepening() {
 }
 
 
+// Takes the latest result of a PV line searched by another group of threads,
+// see MultiPVBoard, and puts its move at the given index of the root moves.
+// Returns false if there is no result or its move is already on an earlier line.
+bool Search::Worker::import_pv_line(size_t idx) {
+
+    RootMove rm(Move::none());
+    if (!threads.multiPVBoard.get(idx, rm))
+        return false;
+
+    auto it = std::find(rootMoves.begin() + idx, rootMoves.begin() + pvLast, rm.pv[0]);
+    if (it == rootMoves.begin() + pvLast)
+        return false;
+
+    std::rotate(rootMoves.begin() + idx, it, it + 1);
+
+    rm.effort      = rootMoves[idx].effort;
+    rootMoves[idx] = std::move(rm);
+    return true;
+}
+
 void Search::Worker::do_move(Position& pos, const Move move, StateInfo& st) {
     do_move(pos, move, st, pos.gives_check(move));
 }
 
 void Search::Worker::do_move(Position& pos, const Move move, StateInfo& st, const bool givesCheck) {
-    DirtyPiece dp = pos.do_move(move, st, givesCheck, &tt);
-    nodes.fetch_add(1, std::memory_order_relaxed);
+    DirtyPiece     dp = pos.do_move(move, st, givesCheck, &tt);
+    const uint64_t n  = nodes.fetch_add(1, std::memory_order_relaxed) + 1;
     accumulatorStack.push(dp);
+
+    if (deterministic && n == nextSync.load(std::memory_order_relaxed))
+        sync_quantum();
 }
 
 void Search::Worker::do_null_move(Position& pos, StateInfo& st) { pos.do_null_move(st, tt); }
@@ -535,15 +705,77 @@ void Search::Worker::undo_move(Position& pos, const Move move) {
 
 void Search::Worker::undo_null_move(Position& pos) { pos.undo_null_move(); }
 
+// Waits for the other threads of a deterministic search at the end of a quantum.
+// The last thread to arrive applies the TT writes of all the threads, in the
+// order of the threads, see complete_quantum().
+void Search::Worker::sync_quantum() {
+
+    const auto start = std::chrono::steady_clock::now();
+
+    threads.quantumBarrier.arrive_and_wait(
+      threads.stop, [this](bool stopRequested) { complete_quantum(stopRequested); });
+
+    syncTime.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count(),
+                       std::memory_order_relaxed);
+}
+
+// Called by the last thread at a synchronization, or when the last thread still
+// searching leaves. The node limit is checked here rather than in check_time(),
+// and the next quantum is shortened so that the threads together stop at most a
+// node per thread past it.
+void Search::Worker::complete_quantum(bool stopRequested) {
+    apply_tt_buffers();
+
+    if (stopRequested)
+    {
+        threads.stop = true;
+        return;
+    }
+
+    uint64_t quantum = QuantumNodes;
+
+    if (limits.nodes && threads.main_thread()->worker->completedDepth >= 1)
+    {
+        const uint64_t searched = threads.nodes_searched();
+
+        if (searched >= limits.nodes)
+        {
+            threads.stop = threads.abortedSearch = true;
+            return;
+        }
+
+        const uint64_t threadCount = threads.size();
+        quantum = std::min(quantum, (limits.nodes - searched + threadCount - 1) / threadCount);
+    }
+
+    for (auto&& th : threads)
+        th->worker->nextSync.store(th->worker->nodes.load(std::memory_order_relaxed) + quantum,
+                                   std::memory_order_relaxed);
+}
+
+// Applies the TT writes of all the threads of a deterministic search, which must
+// not be searching, and records their node counts.
+void Search::Worker::apply_tt_buffers() {
+    for (auto&& th : threads)
+    {
+        tt.apply(th->worker->ttBuffer);
+        th->worker->syncedNodes = th->worker->nodes.load(std::memory_order_relaxed);
+    }
+}
+
 
 // Reset histories, usually before a new game
 void Search::Worker::clear() {
     mainHistory.fill(67);
     captureHistory.fill(-688);
-    pawnHistory.fill(-1287);
-    pawnCorrectionHistory.fill(5);
-    minorPieceCorrectionHistory.fill(0);
-    nonPawnCorrectionHistory.fill(0);
+
+    ownHistories.clear();
+
+    if (clearsSharedHistories && options["SharedHistories"])
+        if (KeyedHistories* shared = sharedHistories[numaAccessToken].racy_tables())
+            shared->clear();
 
     ttMoveHistory = 0;
 
@@ -560,7 +792,16 @@ void Search::Worker::clear() {
     for (size_t i = 1; i < reductions.size(); ++i)
         reductions[i] = int(2796 / 128.0 * std::log(i));
 
-    refreshTable.clear(networks[numaAccessToken]);
+    clear_network_caches();
+}
+
+// Clears the data derived from the outputs of the networks, when they or the
+// networks in use change
+void Search::Worker::clear_network_caches() {
+    refreshTable.clear(networks[numaAccessToken], options["SmallNetOnly"]);
+    accumulatorStack.allocate(options["SmallNetOnly"]);
+    if (evalCache)
+        evalCache->clear();
 }
 
 
@@ -806,7 +1047,7 @@ Value Search::Worker::search(
         int bonus = std::clamp(-10 * int((ss - 1)->staticEval + ss->staticEval), -1858, 1492) + 661;
         mainHistory[~us][((ss - 1)->currentMove).from_to()] << bonus * 1057 / 1024;
         if (type_of(pos.piece_on(prevSq)) != PAWN && ((ss - 1)->currentMove).type_of() != PROMOTION)
-            pawnHistory[pawn_structure_index(pos)][pos.piece_on(prevSq)][prevSq]
+            histories->pawnHistory[pawn_structure_index(pos)][pos.piece_on(prevSq)][prevSq]
               << bonus * 1266 / 1024;
     }
 
@@ -964,15 +1205,28 @@ moves_loop:  // When in check, search starts here
 
 
     MovePicker mp(pos, ttData.move, depth, &mainHistory, &lowPlyHistory, &captureHistory, contHist,
-                  &pawnHistory, ss->ply);
+                  &histories->pawnHistory, ss->ply);
 
     value = bestValue;
 
     int moveCount = 0;
 
+    // Mark the node as being searched, and collect the late moves leading to nodes
+    // already searched by other threads to search them after the others.
+    const bool    markNode = deferBusyMoves && !rootNode && !excludedMove
+                       && depth >= SearchingTable::MinDepth;
+    SearchingMark searchingMark(searchingTable, markNode, posKey, depth, threadIdx);
+    Move          deferredMoves[MaxDeferredMoves];
+    int           deferredCount = 0, deferredIdx = 0;
+
+    auto next_move = [&]() {
+        Move m = mp.next_move();
+        return m == Move::none() && deferredIdx < deferredCount ? deferredMoves[deferredIdx++] : m;
+    };
+
     // Step 13. Loop through all pseudo-legal moves until no moves remain
     // or a beta cutoff occurs.
-    while ((move = mp.next_move()) != Move::none())
+    while ((move = next_move()) != Move::none())
     {
         assert(move.is_ok());
 
@@ -1062,9 +1316,10 @@ moves_loop:  // When in check, search starts here
             }
             else
             {
-                int history = (*contHist[0])[movedPiece][move.to_sq()]
-                            + (*contHist[1])[movedPiece][move.to_sq()]
-                            + pawnHistory[pawn_structure_index(pos)][movedPiece][move.to_sq()];
+                int history =
+                  (*contHist[0])[movedPiece][move.to_sq()]
+                  + (*contHist[1])[movedPiece][move.to_sq()]
+                  + histories->pawnHistory[pawn_structure_index(pos)][movedPiece][move.to_sq()];
 
                 // Continuation history based pruning
                 if (history < -4229 * depth)
@@ -1097,6 +1352,16 @@ moves_loop:  // When in check, search starts here
             }
         }
 
+        // Defer the move if another thread is already searching the resulting
+        // position, it is searched again once the move picker is exhausted.
+        if (markNode && moveCount > 1 && !deferredIdx && deferredCount < MaxDeferredMoves
+            && searchingTable.is_busy(pos.key_after(move), newDepth - 2, threadIdx))
+        {
+            deferredMoves[deferredCount++] = move;
+            ss->moveCount                  = --moveCount;
+            continue;
+        }
+
         // Step 15. Extensions
         // Singular extension search. If all moves but one
         // fail low on a search of (alpha-s, beta-s), and just one fails high on
@@ -1429,7 +1694,7 @@ moves_loop:  // When in check, search starts here
         mainHistory[~us][((ss - 1)->currentMove).from_to()] << scaledBonus * 203 / 32768;
 
         if (type_of(pos.piece_on(prevSq)) != PAWN && ((ss - 1)->currentMove).type_of() != PROMOTION)
-            pawnHistory[pawn_structure_index(pos)][pos.piece_on(prevSq)][prevSq]
+            histories->pawnHistory[pawn_structure_index(pos)][pos.piece_on(prevSq)][prevSq]
               << scaledBonus * 1040 / 32768;
     }
 
@@ -1600,7 +1865,7 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta)
     // the moves. We presently use two stages of move generator in quiescence search:
     // captures, or evasions only when in check.
     MovePicker mp(pos, ttData.move, DEPTH_QS, &mainHistory, &lowPlyHistory, &captureHistory,
-                  contHist, &pawnHistory, ss->ply);
+                  contHist, &histories->pawnHistory, ss->ply);
 
     // Step 5. Loop through all pseudo-legal moves until no moves remain or a beta
     // cutoff occurs.
@@ -1648,7 +1913,8 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta)
             // Continuation history based pruning
             if (!capture
                 && (*contHist[0])[pos.moved_piece(move)][move.to_sq()]
-                       + pawnHistory[pawn_structure_index(pos)][pos.moved_piece(move)][move.to_sq()]
+                       + histories->pawnHistory[pawn_structure_index(pos)][pos.moved_piece(move)]
+                                               [move.to_sq()]
                      <= 6218)
                 continue;
 
@@ -1754,7 +2020,7 @@ TimePoint Search::Worker::elapsed_time() const { return main_manager()->tm.elaps
 
 Value Search::Worker::evaluate(const Position& pos) {
     return Eval::evaluate(networks[numaAccessToken], pos, accumulatorStack, refreshTable,
-                          optimism[pos.side_to_move()]);
+                          evalCache.get(), optimism[pos.side_to_move()]);
 }
 
 namespace {
@@ -1898,7 +2164,7 @@ void update_quiet_histories(
                                   bonus * (bonus > 0 ? 1082 : 784) / 1024);
 
     int pIndex = pawn_structure_index(pos);
-    workerThread.pawnHistory[pIndex][pos.moved_piece(move)][move.to_sq()]
+    workerThread.histories->pawnHistory[pIndex][pos.moved_piece(move)][move.to_sq()]
       << (bonus * (bonus > 0 ? 705 : 450) / 1024) + 70;
 }
 
@@ -1966,7 +2232,8 @@ void SearchManager::check_time(Search::Worker& worker) {
       worker.completedDepth >= 1
       && ((worker.limits.use_time_management() && (elapsed > tm.maximum() || stopOnPonderhit))
           || (worker.limits.movetime && elapsed >= worker.limits.movetime)
-          || (worker.limits.nodes && worker.threads.nodes_searched() >= worker.limits.nodes)))
+          || (worker.limits.nodes && !worker.deterministic
+              && worker.threads.nodes_searched() >= worker.limits.nodes)))
         worker.threads.stop = worker.threads.abortedSearch = true;
 }
 
@@ -2111,7 +2378,10 @@ void SearchManager::pv(Search::Worker&           worker,
                        const TranspositionTable& tt,
                        Depth                     depth) {
 
-    const auto nodes     = threads.nodes_searched();
+    // In a deterministic search the other threads are counted at the last synchronization
+    const auto nodes     = worker.deterministic
+                           ? threads.synced_nodes_searched() - worker.syncedNodes + worker.nodes
+                           : threads.nodes_searched();
     auto&      rootMoves = worker.rootMoves;
     auto&      pos       = worker.rootPos;
     size_t     pvIdx     = worker.pvIdx;
@@ -23,14 +23,18 @@
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "evaluate.h"
 #include "history.h"
 #include "misc.h"
 #include "nnue/network.h"
@@ -40,6 +44,7 @@
 #include "score.h"
 #include "syzygy/tbprobe.h"
 #include "timeman.h"
+#include "tt.h"
 #include "types.h"
 
 namespace Stockfish {
@@ -51,7 +56,6 @@ enum NodeType {
     Root
 };
 
-class TranspositionTable;
 class ThreadPool;
 class OptionsMap;
 
@@ -109,6 +113,126 @@ struct RootMove {
 
 using RootMoves = std::vector<RootMove>;
 
+// With the SplitMultiPV option the threads are divided in groups searching
+// different PV lines. Each group publishes the lines it completes here, and
+// takes the other lines from here into its own root moves.
+class MultiPVBoard {
+   public:
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        lines.clear();
+    }
+
+    void publish(std::size_t pvIdx, Depth depth, const RootMove& rootMove) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (lines.size() <= pvIdx)
+            lines.resize(pvIdx + 1, {0, rootMove});
+
+        if (depth >= lines[pvIdx].depth)
+            lines[pvIdx] = {depth, rootMove};
+
+        cv.notify_all();
+    }
+
+    // Returns the depth of the latest result of the line, 0 if there is none yet
+    Depth get(std::size_t pvIdx, RootMove& rootMove) const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!depth_of(pvIdx))
+            return 0;
+
+        rootMove = lines[pvIdx].rootMove;
+        return lines[pvIdx].depth;
+    }
+
+    // Sleeps until the line has a result of at least the given depth, but at most 1 ms,
+    // so that the caller can check the time and the stop flag, which do not notify.
+    // Returns whether the result is there.
+    bool wait_for(std::size_t pvIdx, Depth depth) const {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, std::chrono::milliseconds(1),
+                           [&] { return depth_of(pvIdx) >= depth; });
+    }
+
+   private:
+    struct Line {
+        Depth    depth;
+        RootMove rootMove;
+    };
+
+    Depth depth_of(std::size_t pvIdx) const {
+        return pvIdx < lines.size() ? lines[pvIdx].depth : 0;
+    }
+
+    mutable std::mutex              mutex;
+    mutable std::condition_variable cv;
+    std::vector<Line>               lines;
+};
+
+
+// With the DeterministicSearch option the threads meet here every time they have
+// searched a fixed number of nodes. The last one to arrive runs the completion
+// alone, while the others wait, and then they all resume. Waiting threads also
+// return when the search is stopped from outside, e.g. by the GUI.
+class QuantumBarrier {
+   public:
+    void reset(std::size_t threadCount) {
+        std::lock_guard<std::mutex> lock(mutex);
+        participants  = threadCount;
+        arrived       = 0;
+        stopRequested = false;
+    }
+
+    // The completion is called with whether a thread that left asked to stop
+    template<typename F>
+    void arrive_and_wait(const std::atomic_bool& stop, F&& onComplete) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (++arrived == participants)
+        {
+            complete(onComplete);
+            return;
+        }
+
+        const std::uint64_t gen = generation;
+        while (gen == generation && !stop)
+            cv.wait_for(lock, std::chrono::milliseconds(1));
+
+        // A thread returning on a stop is no longer waiting, so that the barrier
+        // can't complete while it searches, and isn't counted again by leave().
+        if (gen == generation)
+            --arrived;
+    }
+
+    // Called by a thread that doesn't search anymore, the others no longer wait for it
+    template<typename F>
+    void leave(bool requestStop, F&& onComplete) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        --participants;
+        stopRequested |= requestStop;
+
+        if (arrived == participants)
+            complete(onComplete);
+    }
+
+   private:
+    template<typename F>
+    void complete(F& onComplete) {
+        onComplete(stopRequested);
+        arrived = 0;
+        ++generation;
+        cv.notify_all();
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::size_t             participants = 0, arrived = 0;
+    std::uint64_t           generation    = 0;
+    bool                    stopRequested = false;
+};
+
 
 // LimitsType struct stores information sent by the caller about the analysis required.
 struct LimitsType {
@@ -131,22 +255,82 @@ struct LimitsType {
 };
 
 
+// SearchingTable marks the nodes the threads are currently searching, as in
+// ABDADA. With the DeferBusyMoves option a thread searches a late move after the
+// others when another thread is already searching the resulting position, so
+// that the threads spread over different subtrees. The table is shared and
+// lock-free: entries are accessed with relaxed atomics and races only change
+// the order in which moves are searched.
+class SearchingTable {
+   public:
+    // Only nodes at least this deep are marked
+    static constexpr Depth MinDepth = 6;
+
+    struct Entry {
+        std::atomic<Key>           key;
+        std::atomic<std::uint32_t> owner;  // Index + 1 of the searching thread, 0 if free
+        std::atomic<Depth>         depth;
+    };
+
+    // Marks the node as searched by the thread if its slot is free, and returns
+    // the entry to release when leaving the node.
+    Entry* enter(Key key, Depth depth, std::size_t threadIdx) {
+        Entry&        e        = entries[key & (Size - 1)];
+        std::uint32_t expected = 0;
+
+        if (e.owner.load(std::memory_order_relaxed)
+            || !e.owner.compare_exchange_strong(expected, std::uint32_t(threadIdx + 1),
+                                                std::memory_order_relaxed))
+            return nullptr;
+
+        e.key.store(key, std::memory_order_relaxed);
+        e.depth.store(depth, std::memory_order_relaxed);
+        return &e;
+    }
+
+    static void leave(Entry* e) {
+        if (e)
+            e->owner.store(0, std::memory_order_relaxed);
+    }
+
+    // Whether another thread is searching the node at least at the given depth
+    bool is_busy(Key key, Depth depth, std::size_t threadIdx) const {
+        const Entry&        e     = entries[key & (Size - 1)];
+        const std::uint32_t owner = e.owner.load(std::memory_order_relaxed);
+
+        return owner && owner != threadIdx + 1 && e.key.load(std::memory_order_relaxed) == key
+            && e.depth.load(std::memory_order_relaxed) >= depth;
+    }
+
+   private:
+    static constexpr std::size_t Size = 4096;
+
+    std::array<Entry, Size> entries{};
+};
+
+
 // The UCI stores the uci options, thread pool, and transposition table.
 // This struct is used to easily forward data to the Search::Worker class.
 struct SharedState {
     SharedState(const OptionsMap&                               optionsMap,
                 ThreadPool&                                     threadPool,
                 TranspositionTable&                             transpositionTable,
-                const LazyNumaReplicated<Eval::NNUE::Networks>& nets) :
+                SearchingTable&                                 searching,
+                const LazyNumaReplicated<Eval::NNUE::Networks>& nets,
+                const LazyNumaReplicated<SharedHistories>&      histories) :
         options(optionsMap),
         threads(threadPool),
         tt(transpositionTable),
-        networks(nets) {}
+        searchingTable(searching),
+        networks(nets),
+        sharedHistories(histories) {}
 
     const OptionsMap&                               options;
     ThreadPool&                                     threads;
     TranspositionTable&                             tt;
+    SearchingTable&                                 searchingTable;
     const LazyNumaReplicated<Eval::NNUE::Networks>& networks;
+    const LazyNumaReplicated<SharedHistories>&      sharedHistories;
 };
 
 class Worker;
@@ -278,6 +462,8 @@ class Worker {
     bool is_mainthread() const { return threadIdx == 0; }
 
     void ensure_network_replicated();
+    void clear_network_caches();
+    size_t nnue_memory_usage() const;
 
     // Public because they need to be updatable by the stats
     ButterflyHistory mainHistory;
@@ -285,23 +471,27 @@ class Worker {
 
     CapturePieceToHistory captureHistory;
     ContinuationHistory   continuationHistory[2][2];
-    PawnHistory           pawnHistory;
 
-    CorrectionHistory<Pawn>         pawnCorrectionHistory;
-    CorrectionHistory<Minor>        minorPieceCorrectionHistory;
-    CorrectionHistory<NonPawn>      nonPawnCorrectionHistory;
+    // The pawn and keyed correction histories in use, either ownHistories or the
+    // copy of the NUMA node of the thread, see SharedHistories
+    KeyedHistories* histories;
+
     CorrectionHistory<Continuation> continuationCorrectionHistory;
 
     TTMoveHistory ttMoveHistory;
 
    private:
     void iterative_deepening();
+    bool import_pv_line(std::size_t pvIdx);
 
     void do_move(Position& pos, const Move move, StateInfo& st);
     void do_move(Position& pos, const Move move, StateInfo& st, const bool givesCheck);
     void do_null_move(Position& pos, StateInfo& st);
     void undo_move(Position& pos, const Move move);
     void undo_null_move(Position& pos);
+    void sync_quantum();
+    void complete_quantum(bool stopRequested);
+    void apply_tt_buffers();
 
     // This is the main search function, for both PV and non-PV nodes
     template<NodeType nodeType>
@@ -326,9 +516,10 @@ class Worker {
 
     LimitsType limits;
 
-    size_t                pvIdx, pvLast;
+    size_t                pvIdx, pvLast, pvGroup, pvGroups;
     std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
     int                   selDepth, nmpMinPly;
+    TTStats               ttStats;
 
     Value optimism[COLOR_NB];
 
@@ -352,16 +543,54 @@ class Worker {
     const OptionsMap&                               options;
     ThreadPool&                                     threads;
     TranspositionTable&                             tt;
+    SearchingTable&                                 searchingTable;
     const LazyNumaReplicated<Eval::NNUE::Networks>& networks;
 
+    // The keyed histories of the thread, used unless it shares those of its NUMA node.
+    // The first thread of each node clears the shared copy.
+    KeyedHistories                             ownHistories;
+    const LazyNumaReplicated<SharedHistories>& sharedHistories;
+    bool                                       clearsSharedHistories;
+
+    // Whether moves to nodes searched by other threads are deferred, see SearchingTable
+    bool deferBusyMoves;
+
+    // Whether the threads synchronize every QuantumNodes nodes, see QuantumBarrier.
+    // Between two synchronizations the writes to the TT are kept in ttBuffer. The
+    // node count at the last one and at the next one, and the time spent
+    // synchronizing are kept too.
+    bool                  deterministic;
+    TTWriteBuffer         ttBuffer;
+    std::atomic<uint64_t> syncedNodes, nextSync, syncTime;
+
     // Used by NNUE
     Eval::NNUE::AccumulatorStack  accumulatorStack;
     Eval::NNUE::AccumulatorCaches refreshTable;
+    std::unique_ptr<Eval::EvalCache> evalCache;  // Only with the EvalCache option
+
+    void prepare_eval_cache();
+
+    // The statistics of type T of the thread, null if it keeps none, see ThreadPool::stats()
+    template<typename T>
+    T* stats();
 
     friend class Stockfish::ThreadPool;
     friend class SearchManager;
 };
 
+template<>
+inline TTStats* Worker::stats<TTStats>() {
+    return &ttStats;
+}
+template<>
+inline Eval::EvalCacheStats* Worker::stats<Eval::EvalCacheStats>() {
+    return evalCache ? &evalCache->stats : nullptr;
+}
+template<>
+inline Eval::NNUE::NnueStats* Worker::stats<Eval::NNUE::NnueStats>() {
+    return &accumulatorStack.stats;
+}
+
 struct ConthistBonus {
     int index;
     int weight;
@@ -53,8 +53,8 @@ Thread::Thread(Search::SharedState&                    sharedState,
         // the Worker allocation. Ideally we would also allocate the SearchManager
         // here, but that's minor.
         this->numaAccessToken = binder();
-        this->worker =
-          std::make_unique<Search::Worker>(sharedState, std::move(sm), n, this->numaAccessToken);
+        this->worker          = make_unique_large_page<Search::Worker>(sharedState, std::move(sm),
+                                                                       n, this->numaAccessToken);
     });
 
     wait_for_search_finished();
@@ -131,8 +131,40 @@ void Thread::idle_loop() {
 Search::SearchManager* ThreadPool::main_manager() { return main_thread()->worker->main_manager(); }
 
 uint64_t ThreadPool::nodes_searched() const { return accumulate(&Search::Worker::nodes); }
+uint64_t ThreadPool::synced_nodes_searched() const {
+    return accumulate(&Search::Worker::syncedNodes);
+}
 uint64_t ThreadPool::tb_hits() const { return accumulate(&Search::Worker::tbHits); }
 
+// Microseconds spent by the threads in the synchronizations of a deterministic search
+uint64_t ThreadPool::sync_time() const { return accumulate(&Search::Worker::syncTime); }
+
+// Sums the statistics of type T of the threads. The counters are relaxed atomics, so
+// they can be read during the search.
+template<typename T>
+T ThreadPool::stats() const {
+
+    T sum;
+    for (auto&& th : threads)
+        if (const T* s = th->worker->stats<T>())
+            sum += *s;
+    return sum;
+}
+
+template<typename T>
+void ThreadPool::clear_stats() {
+    for (auto&& th : threads)
+        if (T* s = th->worker->stats<T>())
+            *s = T();
+}
+
+template TTStats               ThreadPool::stats<TTStats>() const;
+template Eval::EvalCacheStats  ThreadPool::stats<Eval::EvalCacheStats>() const;
+template Eval::NNUE::NnueStats ThreadPool::stats<Eval::NNUE::NnueStats>() const;
+template void                  ThreadPool::clear_stats<TTStats>();
+template void                  ThreadPool::clear_stats<Eval::EvalCacheStats>();
+template void                  ThreadPool::clear_stats<Eval::NNUE::NnueStats>();
+
 // Creates/destroys threads to match the requested number.
 // Created and launched threads will immediately go to sleep in idle_loop.
 // Upon resizing, threads are recreated to allow for binding if necessary.
@@ -248,6 +280,8 @@ void ThreadPool::start_thinking(const OptionsMap&  options,
     main_manager()->ponder                                 = limits.ponderMode;
 
     increaseDepth = true;
+    multiPVBoard.clear();
+    quantumBarrier.reset(size());
 
     Search::RootMoves rootMoves;
     const auto        legalmoves = MoveList<LEGAL>(pos);
@@ -283,12 +317,13 @@ void ThreadPool::start_thinking(const OptionsMap&  options,
         th->run_custom_job([&]() {
             th->worker->limits = limits;
             th->worker->nodes = th->worker->tbHits = th->worker->nmpMinPly =
-              th->worker->bestMoveChanges          = 0;
+              th->worker->bestMoveChanges = th->worker->syncedNodes = th->worker->syncTime = 0;
             th->worker->rootDepth = th->worker->completedDepth = 0;
             th->worker->rootMoves                              = rootMoves;
             th->worker->rootPos.set(pos.fen(), pos.is_chess960(), &th->worker->rootState);
             th->worker->rootState = setupStates->back();
             th->worker->tbConfig  = tbConfig;
+            th->worker->prepare_eval_cache();
         });
     }
 
@@ -407,4 +442,13 @@ void ThreadPool::ensure_network_replicated() {
         th->ensure_network_replicated();
 }
 
+// Clears the caches of the network outputs of all the workers, in parallel
+void ThreadPool::clear_network_caches() {
+    for (auto&& th : threads)
+        th->run_custom_job([&th]() { th->worker->clear_network_caches(); });
+
+    for (auto&& th : threads)
+        th->wait_for_search_finished();
+}
+
 }  // namespace Stockfish
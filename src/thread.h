@@ -28,6 +28,7 @@
 #include <mutex>
 #include <vector>
 
+#include "memory.h"
 #include "numa.h"
 #include "position.h"
 #include "search.h"
@@ -93,8 +94,8 @@ class Thread {
     void   wait_for_search_finished();
     size_t id() const { return idx; }
 
-    std::unique_ptr<Search::Worker> worker;
-    std::function<void()>           jobFunc;
+    LargePagePtr<Search::Worker> worker;
+    std::function<void()>        jobFunc;
 
    private:
     std::mutex                mutex;
@@ -141,16 +142,28 @@ class ThreadPool {
     Search::SearchManager* main_manager();
     Thread*                main_thread() const { return threads.front().get(); }
     uint64_t               nodes_searched() const;
+    uint64_t               synced_nodes_searched() const;
+    uint64_t               sync_time() const;
     uint64_t               tb_hits() const;
+    template<typename T>
+    T                      stats() const;
+    template<typename T>
+    void                   clear_stats();
     Thread*                get_best_thread() const;
     void                   start_searching();
     void                   wait_for_search_finished() const;
 
     std::vector<size_t> get_bound_thread_count_by_numa_node() const;
 
+    // The NUMA node each thread is bound to, empty when threads are not bound
+    const std::vector<NumaIndex>& get_bound_numa_nodes() const { return boundThreadToNumaNode; }
+
     void ensure_network_replicated();
+    void clear_network_caches();
 
-    std::atomic_bool stop, abortedSearch, increaseDepth;
+    std::atomic_bool       stop, abortedSearch, increaseDepth;
+    Search::MultiPVBoard   multiPVBoard;
+    Search::QuantumBarrier quantumBarrier;
 
     auto cbegin() const noexcept { return threads.cbegin(); }
     auto begin() noexcept { return threads.begin(); }
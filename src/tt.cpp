@@ -18,14 +18,22 @@
 
 #include "tt.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <climits>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "memory.h"
 #include "misc.h"
+#include "numa.h"
 #include "syzygy/tbprobe.h"
 #include "thread.h"
 
@@ -34,7 +42,7 @@ namespace Stockfish {
 
 // TTEntry struct is the 10 bytes transposition table entry, defined as below:
 //
-// key        16 bit
+// key        16 bit (32 bit with TTLayoutLongKey, making the entry 12 bytes)
 // depth       8 bit
 // generation  5 bit
 // pv node     1 bit
@@ -46,6 +54,7 @@ namespace Stockfish {
 // These fields are in the same order as accessed by TT::probe(), since memory is fastest sequentially.
 // Equally, the store order in save() matches this order.
 
+template<typename KeyType>
 struct TTEntry {
 
     // Convert internal bitfields to external types
@@ -56,14 +65,26 @@ struct TTEntry {
     }
 
     bool is_occupied() const;
-    void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
+    void save(Key          k,
+              Value        v,
+              bool         pv,
+              Bound        b,
+              Depth        d,
+              Move         m,
+              Value        ev,
+              uint8_t      generation8,
+              TTOccupancy* occupancy);
     // The returned age is a multiple of TranspositionTable::GENERATION_DELTA
     uint8_t relative_age(const uint8_t generation8) const;
 
    private:
-    friend class TranspositionTable;
+    template<typename Layout>
+    friend class BasicTranspositionTable;
+    template<typename Layout>
+    friend struct TTWriter;
+    friend class TTWriteBuffer;
 
-    uint16_t key16;
+    KeyType  key;
     uint8_t  depth8;
     uint8_t  genBound8;
     Move     move16;
@@ -83,39 +104,89 @@ static constexpr int GENERATION_CYCLE = 255 + GENERATION_DELTA;
 // mask to pull out generation number
 static constexpr int GENERATION_MASK = (0xFF << GENERATION_BITS) & 0xFF;
 
+static_assert(sizeof(TTOccupancy::entries) / sizeof(TTOccupancy::entries[0])
+              == 256 / GENERATION_DELTA);
+
+// The epoch of a cluster being emptied after a lazy clear, never that of the table
+static constexpr uint8_t EPOCH_BUSY = 0xFF;
+
+// Adds delta to the count of occupied entries of the generation of genBound8. Only
+// the owner of the shard calls this, so there is no need for an atomic increment.
+static void count_occupancy(TTOccupancy& shard, uint8_t genBound8, int delta) {
+    std::atomic<int64_t>& n = shard.entries[genBound8 >> GENERATION_BITS];
+    n.store(n.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+// Counts an event of the table in the counters of the calling search thread. Without
+// TT_STATS this is a no-op, so that the arguments are optimized away.
+static void count([[maybe_unused]] StatCounter TTStats::* counter) {
+#ifdef TT_STATS
+    if (ttThreadStats)
+        ++(ttThreadStats->*counter);
+#endif
+}
+
 // DEPTH_ENTRY_OFFSET exists because 1) we use `bool(depth8)` as the occupancy check, but
 // 2) we need to store negative depths for QS. (`depth8` is the only field with "spare bits":
 // we sacrifice the ability to store depths greater than 1<<8 less the offset, as asserted in `save`.)
-bool TTEntry::is_occupied() const { return bool(depth8); }
+template<typename KeyType>
+bool TTEntry<KeyType>::is_occupied() const {
+    return bool(depth8);
+}
 
 // Populates the TTEntry with a new node's data, possibly
 // overwriting an old position. The update is not atomic and can be racy.
-void TTEntry::save(
-  Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8) {
+template<typename KeyType>
+void TTEntry<KeyType>::save(Key          k,
+                            Value        v,
+                            bool         pv,
+                            Bound        b,
+                            Depth        d,
+                            Move         m,
+                            Value        ev,
+                            uint8_t      generation8,
+                            TTOccupancy* occupancy) {
 
     // Preserve the old ttmove if we don't have a new one
-    if (m || uint16_t(k) != key16)
+    if (m || KeyType(k) != key)
         move16 = m;
 
     // Overwrite less valuable entries (cheapest checks first)
-    if (b == BOUND_EXACT || uint16_t(k) != key16 || d - DEPTH_ENTRY_OFFSET + 2 * pv > depth8 - 4
+    if (b == BOUND_EXACT || KeyType(k) != key || d - DEPTH_ENTRY_OFFSET + 2 * pv > depth8 - 4
         || relative_age(generation8))
     {
         assert(d > DEPTH_ENTRY_OFFSET);
         assert(d < 256 + DEPTH_ENTRY_OFFSET);
 
-        key16     = uint16_t(k);
+        count(!is_occupied()              ? &TTStats::fills
+              : KeyType(k) == key         ? &TTStats::updates
+              : relative_age(generation8) ? &TTStats::ageReplacements
+                                          : &TTStats::depthReplacements);
+
+        // Move the entry to the count of its new generation
+        if (occupancy && (!is_occupied() || relative_age(generation8)))
+        {
+            if (is_occupied())
+                count_occupancy(*occupancy, genBound8, -1);
+            count_occupancy(*occupancy, generation8, 1);
+        }
+
+        key       = KeyType(k);
         depth8    = uint8_t(d - DEPTH_ENTRY_OFFSET);
         genBound8 = uint8_t(generation8 | uint8_t(pv) << 2 | b);
         value16   = int16_t(v);
         eval16    = int16_t(ev);
     }
     else if (depth8 + DEPTH_ENTRY_OFFSET >= 5 && Bound(genBound8 & 0x3) != BOUND_EXACT)
+    {
+        count(&TTStats::depthDecrements);
         depth8--;
+    }
 }
 
 
-uint8_t TTEntry::relative_age(const uint8_t generation8) const {
+template<typename KeyType>
+uint8_t TTEntry<KeyType>::relative_age(const uint8_t generation8) const {
     // Due to our packed storage format for generation and its cyclic
     // nature we add GENERATION_CYCLE (256 is the modulus, plus what
     // is needed to keep the unrelated lowest n bits from affecting
@@ -126,12 +197,96 @@ uint8_t TTEntry::relative_age(const uint8_t generation8) const {
 
 
 // TTWriter is but a very thin wrapper around the pointer
-TTWriter::TTWriter(TTEntry* tte) :
-    entry(tte) {}
+#if defined(TT_STATS) && !defined(NDEBUG)
+template<typename Layout>
+TTWriter<Layout>::TTWriter(Entry* tte, TTOccupancy* occ, Key* fk) :
+    entry(tte),
+    occupancy(occ),
+    fullKey(fk) {}
+#else
+template<typename Layout>
+TTWriter<Layout>::TTWriter(Entry* tte, TTOccupancy* occ) :
+    entry(tte),
+    occupancy(occ) {}
+#endif
 
-void TTWriter::write(
+template<typename Layout>
+void TTWriter<Layout>::write(
   Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8) {
-    entry->save(k, v, pv, b, d, m, ev, generation8);
+    count(&TTStats::writes);
+
+    // Deferred writes start from the entry of the position in the table, so that
+    // they are replayed with the same effect as if they had been made to it.
+    if (ttThreadBuffer)
+    {
+        TTWriteBuffer::Entry* tte = ttThreadBuffer->find(k);
+
+        if (!tte && (tte = ttThreadBuffer->insert(k)) && entry->is_occupied()
+            && entry->key == typename Layout::KeyType(k))
+        {
+            tte->depth8    = entry->depth8;
+            tte->genBound8 = entry->genBound8;
+            tte->move16    = entry->move16;
+            tte->value16   = entry->value16;
+            tte->eval16    = entry->eval16;
+        }
+
+        // The write is lost when the buffer is full
+        if (tte)
+            tte->save(k, v, pv, b, d, m, ev, generation8, nullptr);
+        return;
+    }
+
+    entry->save(k, v, pv, b, d, m, ev, generation8, occupancy);
+
+#if defined(TT_STATS) && !defined(NDEBUG)
+    if (entry->key == typename Layout::KeyType(k))
+        *fullKey = k;
+#endif
+}
+
+
+TTStats& TTStats::operator+=(const TTStats& s) {
+    probes += s.probes;
+    hits += s.hits;
+    collisions += s.collisions;
+    writes += s.writes;
+    fills += s.fills;
+    updates += s.updates;
+    ageReplacements += s.ageReplacements;
+    depthReplacements += s.depthReplacements;
+    depthDecrements += s.depthDecrements;
+    return *this;
+}
+
+std::ostream& operator<<(std::ostream& os, [[maybe_unused]] const TTStats& s) {
+#ifndef TT_STATS
+    return os << "TT statistics are not available, build with ttstats=yes";
+#else
+    const uint64_t dropped =
+      s.writes - s.fills - s.updates - s.ageReplacements - s.depthReplacements;
+
+    os << "TT probes                  : " << s.probes
+       << "\n    hits                   : " << s.hits << " (" << percent(s.hits, s.probes) << ")"
+       << "\n    misses                 : " << s.probes - s.hits << " ("
+       << percent(s.probes - s.hits, s.probes) << ")";
+#ifndef NDEBUG
+    os << "\n    collisions             : " << s.collisions << " ("
+       << percent(s.collisions, s.hits) << " of hits)";
+#endif
+    os << "\nTT writes                  : " << s.writes
+       << "\n    to empty entries       : " << s.fills << " (" << percent(s.fills, s.writes) << ")"
+       << "\n    same position          : " << s.updates << " (" << percent(s.updates, s.writes)
+       << ")"
+       << "\n    replaced by age        : " << s.ageReplacements << " ("
+       << percent(s.ageReplacements, s.writes) << ")"
+       << "\n    replaced by depth      : " << s.depthReplacements << " ("
+       << percent(s.depthReplacements, s.writes) << ")"
+       << "\n    dropped                : " << dropped << " (" << percent(dropped, s.writes) << ")"
+       << "\n    depth decrements       : " << s.depthDecrements;
+
+    return os;
+#endif
 }
 
 
@@ -139,26 +294,151 @@ void TTWriter::write(
 // of TTEntry. Each non-empty TTEntry contains information on exactly one position. The size of a Cluster should
 // divide the size of a cache line for best performance, as the cacheline is prefetched when possible.
 
-static constexpr int ClusterSize = 3;
+template<typename Layout>
+struct TTCluster {
+    using Entry = TTEntry<typename Layout::KeyType>;
+
+    Entry                entry[Layout::ClusterSize];
+    std::atomic<uint8_t> epoch;  // The lazy_clear() the entries were written after, see probe()
+    char                 padding[Layout::ClusterBytes - Layout::ClusterSize * sizeof(Entry) - 1];
+};
+
+static_assert(sizeof(TTCluster<TTLayoutCompact>) == 32, "Suboptimal Cluster size");
+static_assert(sizeof(TTCluster<TTLayoutCacheLine>) == 64, "Suboptimal Cluster size");
+static_assert(sizeof(TTCluster<TTLayoutLongKey>) == 64, "Suboptimal Cluster size");
+
 
-struct Cluster {
-    TTEntry entry[ClusterSize];
-    char    padding[2];  // Pad to 32 bytes
+// A saved table is a TTFileHeader followed by the raw Cluster array. The header records
+// everything that determines the in-memory layout, so that files written by an engine with
+// a different entry format, table size or byte order are rejected instead of misread.
+struct TTFileHeader {
+    char     magic[8];
+    uint32_t byteOrder;
+    uint32_t entrySize;
+    uint32_t clusterSize;
+    uint32_t entriesPerCluster;
+    uint32_t generationBits;
+    uint8_t  generation8;
+    uint8_t  padding[3];
+    uint64_t clusterCount;
 };
 
-static_assert(sizeof(Cluster) == 32, "Suboptimal Cluster size");
+static constexpr char     TTFileMagic[8]  = "SFHASH1";
+static constexpr uint32_t TTFileByteOrder = 0x01020304;
+
+template<typename Layout>
+static TTFileHeader make_file_header(size_t clusterCount, uint8_t generation8) {
+    TTFileHeader header{};
+    std::memcpy(header.magic, TTFileMagic, sizeof(TTFileMagic));
+    header.byteOrder         = TTFileByteOrder;
+    header.entrySize         = sizeof(TTEntry<typename Layout::KeyType>);
+    header.clusterSize       = sizeof(TTCluster<Layout>);
+    header.entriesPerCluster = Layout::ClusterSize;
+    header.generationBits    = GENERATION_BITS;
+    header.generation8       = generation8;
+    header.clusterCount      = clusterCount;
+    return header;
+}
+
+
+// When the table is shared between processes, the shared memory object starts with this
+// header, padded to a page so that the clusters that follow keep their alignment. The
+// generation lives here so that all the processes age the entries consistently.
+struct SharedTTHeader {
+    std::atomic<uint8_t> generation8;
+};
+
+static constexpr size_t SharedTTHeaderSize = 4096;
+
+static_assert(sizeof(SharedTTHeader) <= SharedTTHeaderSize);
 
 
 // Sets the size of the transposition table,
 // measured in megabytes. Transposition table consists
 // of clusters and each cluster consists of ClusterSize number of TTEntry.
-void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
-    aligned_large_pages_free(table);
+// If sharedName is not empty, the table is placed in the named shared memory
+// object, so that several engine processes probe and write the same racy table.
+// Otherwise the pages are placed on NUMA nodes by the first touch in clear(),
+// and the entries of the previous private table are migrated into the new one.
+// Both tables are then in memory at once, so growing from 128GB to 256GB needs
+// 384GB at the peak. If there isn't that much available, or the new table can't be
+// allocated next to the old one, the old one is freed first and its entries are
+// lost, as with a clear.
+template<typename Layout>
+void BasicTranspositionTable<Layout>::resize(size_t             mbSize,
+                                             ThreadPool&        threads,
+                                             const std::string& newSharedName,
+                                             TTPlacement        newPlacement) {
+
+    finish_lazy_clear();
+
+    // The same table is kept as it is, e.g. when the threads change, but the occupancy
+    // counters have a shard per thread
+    if (table && clusterCount == mbSize * 1024 * 1024 / sizeof(Cluster)
+        && sharedName == newSharedName && placement == newPlacement)
+    {
+        if (!sharedHeader)
+            recount_occupancy(threads);
+        return;
+    }
+
+    // Keep a private table alive until its contents have been moved over
+    Cluster*       oldTable        = sharedHeader ? nullptr : table;
+    const size_t   oldClusterCount = clusterCount;
+    const uint8_t  oldGeneration8  = generation8;
+
+    if (sharedHeader)
+        deallocate();
+
+    clusterCount    = mbSize * 1024 * 1024 / sizeof(Cluster);
+    placement       = newPlacement;
+    sharedName.clear();
+    table           = nullptr;
+    occupancyShards = threads.num_threads() + 1;
+    occupancy       = std::make_unique<TTOccupancy[]>(occupancyShards);
+
+#if defined(TT_STATS) && !defined(NDEBUG)
+    fullKeys = std::make_unique<Key[]>(clusterCount * Layout::ClusterSize);
+#endif
 
-    clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+    if (!newSharedName.empty())
+    {
+        // The object is either new and zero-filled or already in use by other processes,
+        // in both cases its contents are kept as they are.
+        void* mem =
+          shared_memory_alloc(newSharedName, SharedTTHeaderSize + clusterCount * sizeof(Cluster));
+
+        if (mem)
+        {
+            sharedName   = newSharedName;
+            sharedHeader = static_cast<SharedTTHeader*>(mem);
+            table        = reinterpret_cast<Cluster*>(static_cast<char*>(mem) + SharedTTHeaderSize);
+            generation8  = sharedHeader->generation8;
+            epoch8       = 0;
+            occupancy.reset();  // Other processes write to the table too
+            occupancyShards = 0;
+            aligned_large_pages_free(oldTable);
+            return;
+        }
+    }
+
+    const size_t available = available_memory();
+
+    if (oldTable && available && clusterCount * sizeof(Cluster) > available)
+    {
+        aligned_large_pages_free(oldTable);
+        oldTable = nullptr;
+    }
 
     table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
 
+    if (!table && oldTable)
+    {
+        aligned_large_pages_free(oldTable);
+        oldTable = nullptr;
+        table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+    }
+
     if (!table)
     {
         std::cerr << "Failed to allocate " << mbSize << "MB for transposition table." << std::endl;
@@ -166,24 +446,284 @@ void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
     }
 
     clear(threads);
+
+    if (oldTable)
+    {
+        generation8 = oldGeneration8;
+        migrate(oldTable, oldClusterCount, threads);
+        aligned_large_pages_free(oldTable);
+    }
+}
+
+
+// Returns floor(j * 2^64 / n) and the remainder of the division, for j < n < 2^63.
+// Cluster j of a table of n clusters holds the keys starting from this value (rounded up).
+static std::pair<uint64_t, uint64_t> div_shifted(uint64_t j, uint64_t n) {
+    uint64_t quotient = 0, remainder = j;
+
+    for (int i = 0; i < 64; ++i)
+    {
+        remainder <<= 1;
+        quotient <<= 1;
+
+        if (remainder >= n)
+        {
+            remainder -= n;
+            quotient |= 1;
+        }
+    }
+
+    return {quotient, remainder};
+}
+
+
+// Fills the freshly cleared table with the entries of oldTable, in a multi-threaded way.
+// Each thread owns a range of the new clusters and, for every one of them, collects the
+// entries of the old clusters whose key range overlaps it. When there are more candidates
+// than slots, the deepest and newest ones are kept, using the same replace value as probe().
+// As an entry stores only the low bits of its key, when the table grows we can't tell to which of
+// the overlapping new clusters its position belongs, so it is copied to each of them. The
+// copies in the wrong clusters behave like collisions and are replaced over time.
+template<typename Layout>
+void BasicTranspositionTable<Layout>::migrate(const Cluster* oldTable,
+                                              size_t         oldClusterCount,
+                                              ThreadPool&    threads) {
+    const size_t threadCount = threads.num_threads();
+
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        threads.run_on_thread(i, [this, i, threadCount, oldTable, oldClusterCount]() {
+            const size_t stride = clusterCount / threadCount;
+            const size_t start  = stride * i;
+            const size_t len    = i + 1 != threadCount ? stride : clusterCount - start;
+
+            // Walk the cluster boundaries incrementally, 2^64 = step * clusterCount + stepRem
+            auto [firstKey, firstRem] = div_shifted(start, clusterCount);
+            auto [step, stepRem]      = div_shifted(1, clusterCount);
+
+            auto value = [this](const Entry& e) {
+                return e.is_occupied() ? e.depth8 - e.relative_age(generation8) : INT_MIN;
+            };
+
+            for (size_t j = start; j < start + len; ++j)
+            {
+                const uint64_t lowKey = firstKey + (firstRem != 0);
+
+                firstKey += step;
+                firstRem += stepRem;
+                if (firstRem >= clusterCount)
+                {
+                    firstRem -= clusterCount;
+                    firstKey++;
+                }
+
+                // For the last cluster this wraps around to 2^64 - 1
+                const uint64_t highKey = firstKey + (firstRem != 0) - 1;
+
+                Entry* const tte     = table[j].entry;
+                const size_t   oldLast = mul_hi64(highKey, oldClusterCount);
+
+                for (size_t k = mul_hi64(lowKey, oldClusterCount); k <= oldLast; ++k)
+                    for (const Entry& candidate : oldTable[k].entry)
+                    {
+                        Entry* replace = tte;
+                        for (int l = 1; l < Layout::ClusterSize; ++l)
+                            if (value(*replace) > value(tte[l]))
+                                replace = &tte[l];
+
+                        if (value(candidate) > value(*replace))
+                            *replace = candidate;
+                    }
+            }
+
+            count_occupied(start, len, occupancy[i]);
+        });
+    }
+
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.wait_on_thread(i);
+}
+
+
+template<typename Layout>
+void BasicTranspositionTable<Layout>::deallocate() {
+    if (sharedHeader)
+        shared_memory_free(sharedHeader, SharedTTHeaderSize + clusterCount * sizeof(Cluster));
+    else
+        aligned_large_pages_free(table);
+
+    table        = nullptr;
+    sharedHeader = nullptr;
 }
 
 
 // Initializes the entire transposition table to zero,
-// in a multi-threaded way.
-void TranspositionTable::clear(ThreadPool& threads) {
-    generation8              = 0;
+// in a multi-threaded way. Right after allocation this is
+// also the first touch, which decides the NUMA placement.
+// A shared table is left as is, since other processes may be searching it. It can
+// only be emptied while no process is attached, by removing its shared memory object
+// (or by switching to a new SharedHash name).
+template<typename Layout>
+void BasicTranspositionTable<Layout>::clear(ThreadPool& threads) {
+    finish_lazy_clear();
+
+    if (sharedHeader)
+        return;
+
+    generation8 = 0;
+    epoch8      = 0;
+
+#if defined(TT_STATS) && !defined(NDEBUG)
+    std::fill_n(fullKeys.get(), clusterCount * Layout::ClusterSize, 0);
+#endif
+
+    for (size_t i = 0; i < occupancyShards; ++i)
+        for (auto& n : occupancy[i].entries)
+            n = 0;
+
+    const size_t                  threadCount = threads.num_threads();
+    const std::vector<NumaIndex>& boundNodes  = threads.get_bound_numa_nodes();
+
+    if (placement == TTPlacement::Interleave && !boundNodes.empty())
+    {
+        // Split the table in blocks of the size of a large page and hand them out
+        // round-robin to the nodes that have threads, and within each node round-robin
+        // to its threads. So every page is first touched by a thread of its node.
+        static constexpr size_t BlockClusters = 2 * 1024 * 1024 / sizeof(Cluster);
+        const size_t            blockCount    = (clusterCount + BlockClusters - 1) / BlockClusters;
+
+        const std::vector<size_t> threadsPerNode = threads.get_bound_thread_count_by_numa_node();
+        std::vector<size_t>       denseNode(threadsPerNode.size()), rank(threadCount);
+        std::vector<size_t>       seen(threadsPerNode.size(), 0);
+        size_t                    nodeCount = 0;
+
+        for (size_t n = 0; n < threadsPerNode.size(); ++n)
+            if (threadsPerNode[n])
+                denseNode[n] = nodeCount++;
+
+        for (size_t i = 0; i < threadCount; ++i)
+            rank[i] = seen[boundNodes[i]]++;
+
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            const size_t first = denseNode[boundNodes[i]] + nodeCount * rank[i];
+            const size_t step  = nodeCount * threadsPerNode[boundNodes[i]];
+
+            threads.run_on_thread(i, [this, first, step, blockCount]() {
+                for (size_t b = first; b < blockCount; b += step)
+                {
+                    const size_t start = b * BlockClusters;
+                    const size_t len   = std::min(BlockClusters, clusterCount - start);
+
+                    std::memset(static_cast<void*>(&table[start]), 0, len * sizeof(Cluster));
+                }
+            });
+        }
+    }
+    else
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            threads.run_on_thread(i, [this, i, threadCount]() {
+                // Each thread will zero its part of the hash table
+                const size_t stride = clusterCount / threadCount;
+                const size_t start  = stride * i;
+                const size_t len    = i + 1 != threadCount ? stride : clusterCount - start;
+
+                std::memset(static_cast<void*>(&table[start]), 0, len * sizeof(Cluster));
+            });
+        }
+
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.wait_on_thread(i);
+}
+
+
+// Empties the table without touching its memory, so that a new game starts at once whatever
+// the table size. Bumping the epoch makes every cluster stale: probe() empties a stale cluster
+// before using it, hashfull() skips it, and a background thread empties the others.
+template<typename Layout>
+void BasicTranspositionTable<Layout>::lazy_clear() {
+    finish_lazy_clear();
+
+    // Other processes don't know about the stale entries, and a shared table isn't cleared
+    if (sharedHeader)
+        return;
+
+    epoch8    = uint8_t(epoch8 + 1 == EPOCH_BUSY ? 0 : epoch8 + 1);
+    sweepDone = false;
+    sweeper   = std::make_unique<NativeThread>([this]() { sweep(); });
+}
+
+
+// Empties the clusters not used since the last lazy_clear(), keeping those
+// already emptied by probe()
+template<typename Layout>
+void BasicTranspositionTable<Layout>::sweep() {
+    for (size_t i = 0; i < clusterCount; ++i)
+        if (table[i].epoch.load(std::memory_order_relaxed) != epoch8)
+            empty_stale(table[i], &occupancy[occupancyShards - 1]);
+
+    sweepDone.store(true, std::memory_order_release);
+}
+
+
+// Zeroes the entries of a cluster written before the last lazy_clear() and marks it as
+// current. The sweeper and the search threads may get there at the same time, so the
+// cluster is first claimed by setting its epoch to EPOCH_BUSY: only the claiming thread
+// empties it and uncounts its entries, and the others wait until it is current, so that
+// no entry is written before the cluster is empty.
+template<typename Layout>
+void BasicTranspositionTable<Layout>::empty_stale(Cluster& cluster, TTOccupancy* shard) const {
+    uint8_t epoch = cluster.epoch.load(std::memory_order_acquire);
+
+    while (epoch != epoch8)
+    {
+        if (epoch == EPOCH_BUSY)
+            epoch = cluster.epoch.load(std::memory_order_acquire);
+
+        else if (cluster.epoch.compare_exchange_weak(epoch, EPOCH_BUSY,
+                                                     std::memory_order_acquire))
+        {
+            if (shard)
+                for (const Entry& e : cluster.entry)
+                    if (e.is_occupied())
+                        count_occupancy(*shard, e.genBound8, -1);
+
+            std::memset(static_cast<void*>(cluster.entry), 0, sizeof(cluster.entry));
+            cluster.epoch.store(epoch8, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+
+// Adds the occupied entries of the given clusters to the counts of a shard
+template<typename Layout>
+void BasicTranspositionTable<Layout>::count_occupied(size_t start, size_t len, TTOccupancy& shard) {
+    for (size_t i = start; i < start + len; ++i)
+        for (const Entry& e : table[i].entry)
+            if (e.is_occupied())
+                count_occupancy(shard, e.genBound8, 1);
+}
+
+
+// Gives the occupancy counters a shard per thread of the pool and counts the entries of
+// the table again, in a multi-threaded way
+template<typename Layout>
+void BasicTranspositionTable<Layout>::recount_occupancy(ThreadPool& threads) {
     const size_t threadCount = threads.num_threads();
 
+    occupancyShards = threadCount + 1;
+    occupancy       = std::make_unique<TTOccupancy[]>(occupancyShards);
+
     for (size_t i = 0; i < threadCount; ++i)
     {
         threads.run_on_thread(i, [this, i, threadCount]() {
-            // Each thread will zero its part of the hash table
             const size_t stride = clusterCount / threadCount;
             const size_t start  = stride * i;
             const size_t len    = i + 1 != threadCount ? stride : clusterCount - start;
 
-            std::memset(&table[start], 0, len * sizeof(Cluster));
+            count_occupied(start, len, occupancy[i]);
         });
     }
 
@@ -192,28 +732,185 @@ void TranspositionTable::clear(ThreadPool& threads) {
 }
 
 
-// Returns an approximation of the hashtable
-// occupation during a search. The hash is x permill full, as per UCI protocol.
-// Only counts entries which match the current generation.
-int TranspositionTable::hashfull(int maxAge) const {
+template<typename Layout>
+void BasicTranspositionTable<Layout>::finish_lazy_clear() {
+    if (sweeper)
+    {
+        sweeper->join();
+        sweeper.reset();
+    }
+}
+
+
+// Writes the header and the whole cluster array to the given file.
+template<typename Layout>
+bool BasicTranspositionTable<Layout>::save(const std::string& filename) {
+    finish_lazy_clear();
+
+    const TTFileHeader header = make_file_header<Layout>(clusterCount, generation8);
+
+    std::ofstream stream(filename, std::ios_base::binary);
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(reinterpret_cast<const char*>(table),
+                 std::streamsize(clusterCount * sizeof(Cluster)));
+
+    const bool saved = bool(stream);
+    sync_cout << (saved ? "Hash saved successfully to " + filename : "Failed to save hash")
+              << sync_endl;
+    return saved;
+}
+
+
+// Reads a table written by save() back into memory. The file must have been produced with
+// the same entry layout and the same number of clusters, i.e. the same Hash setting. Like
+// clear(), the work is split among the threads, each one reading its own part of the file.
+template<typename Layout>
+bool BasicTranspositionTable<Layout>::load(const std::string& filename, ThreadPool& threads) {
+    finish_lazy_clear();
+
+    const TTFileHeader expected = make_file_header<Layout>(clusterCount, 0);
+    TTFileHeader       header{};
+
+    std::ifstream stream(filename, std::ios_base::binary);
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!stream || std::memcmp(header.magic, expected.magic, sizeof(header.magic))
+        || header.byteOrder != expected.byteOrder || header.entrySize != expected.entrySize
+        || header.clusterSize != expected.clusterSize
+        || header.entriesPerCluster != expected.entriesPerCluster
+        || header.generationBits != expected.generationBits)
+    {
+        sync_cout << "Failed to load hash: " << filename
+                  << " is not a hash file compatible with this engine" << sync_endl;
+        return false;
+    }
+
+    if (header.clusterCount != clusterCount)
+    {
+        sync_cout << "Failed to load hash: " << filename << " holds a "
+                  << header.clusterCount * sizeof(Cluster) / (1024 * 1024)
+                  << "MB table, set Hash to this value first" << sync_endl;
+        return false;
+    }
+
+    const size_t threadCount = threads.num_threads();
+    auto         succeeded   = std::make_unique<bool[]>(threadCount);
+
+    for (size_t i = 0; i < occupancyShards; ++i)
+        for (auto& n : occupancy[i].entries)
+            n = 0;
+
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        threads.run_on_thread(i, [this, i, threadCount, &filename, &succeeded]() {
+            // Each thread will read its part of the hash table
+            const size_t stride = clusterCount / threadCount;
+            const size_t start  = stride * i;
+            const size_t len    = i + 1 != threadCount ? stride : clusterCount - start;
+
+            std::ifstream part(filename, std::ios_base::binary);
+            part.seekg(std::streamoff(sizeof(TTFileHeader) + start * sizeof(Cluster)));
+            part.read(reinterpret_cast<char*>(&table[start]),
+                      std::streamsize(len * sizeof(Cluster)));
+
+            succeeded[i] = bool(part);
+
+            // The file was saved with no lazy clear pending, all its clusters are current
+            for (size_t j = start; j < start + len; ++j)
+                table[j].epoch.store(epoch8, std::memory_order_relaxed);
+
+            if (occupancy)
+                count_occupied(start, len, occupancy[i]);
+        });
+    }
+
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.wait_on_thread(i);
+
+    if (!std::all_of(succeeded.get(), succeeded.get() + threadCount, [](bool b) { return b; }))
+    {
+        // Don't keep a partially read table around
+        clear(threads);
+        sync_cout << "Failed to load hash: " << filename << " is truncated" << sync_endl;
+        return false;
+    }
+
+    generation8 = header.generation8;
+    if (sharedHeader)
+        sharedHeader->generation8 = generation8;
+
+#if defined(TT_STATS) && !defined(NDEBUG)
+    std::fill_n(fullKeys.get(), clusterCount * Layout::ClusterSize, 0);
+#endif
+
+    sync_cout << "Hash loaded successfully from " << filename << sync_endl;
+    return true;
+}
+
+
+// Returns the hashtable occupation during a search. The hash is x permill full,
+// as per UCI protocol. Only counts entries written during the last maxAge + 1
+// searches. This sums the occupancy counters, so it is cheap enough to be called
+// at will, except for shared tables and during the sweep that follows a lazy clear,
+// whose stale entries aren't told apart by the counters, where a sample is used.
+template<typename Layout>
+int BasicTranspositionTable<Layout>::hashfull(int maxAge) const {
+    if (!occupancy || !sweepDone.load(std::memory_order_acquire))
+        return sampled_hashfull(maxAge);
+
+    const int generations = std::min(maxAge, 256 / GENERATION_DELTA - 1);
+    int64_t   cnt         = 0;
+
+    for (size_t i = 0; i < occupancyShards; ++i)
+        for (int age = 0; age <= generations; ++age)
+        {
+            const uint8_t genBound8 = uint8_t(generation8 - age * GENERATION_DELTA);
+            cnt += occupancy[i].entries[genBound8 >> GENERATION_BITS].load(
+              std::memory_order_relaxed);
+        }
+
+    // Racy writes make the counts approximate, keep the result in range
+    const int64_t entryCount = int64_t(clusterCount) * Layout::ClusterSize;
+    return int(std::clamp<int64_t>(cnt * 1000 / entryCount, 0, 1000));
+}
+
+
+// Approximates the occupation from the first 1000 clusters
+template<typename Layout>
+int BasicTranspositionTable<Layout>::sampled_hashfull(int maxAge) const {
     int maxAgeInternal = maxAge << GENERATION_BITS;
     int cnt            = 0;
     for (int i = 0; i < 1000; ++i)
-        for (int j = 0; j < ClusterSize; ++j)
+    {
+        // Not swept yet since a lazy clear, so empty
+        if (table[i].epoch.load(std::memory_order_relaxed) != epoch8)
+            continue;
+
+        for (int j = 0; j < Layout::ClusterSize; ++j)
             cnt += table[i].entry[j].is_occupied()
                 && table[i].entry[j].relative_age(generation8) <= maxAgeInternal;
+    }
 
-    return cnt / ClusterSize;
+    return cnt / Layout::ClusterSize;
 }
 
 
-void TranspositionTable::new_search() {
+template<typename Layout>
+void BasicTranspositionTable<Layout>::new_search() {
     // increment by delta to keep lower bits as is
-    generation8 += GENERATION_DELTA;
+    if (sharedHeader)
+        generation8 =
+          sharedHeader->generation8.fetch_add(GENERATION_DELTA, std::memory_order_relaxed)
+          + GENERATION_DELTA;
+    else
+        generation8 += GENERATION_DELTA;
 }
 
 
-uint8_t TranspositionTable::generation() const { return generation8; }
+template<typename Layout>
+uint8_t BasicTranspositionTable<Layout>::generation() const {
+    return generation8;
+}
 
 
 // Looks up the current position in the transposition
@@ -222,32 +919,182 @@ uint8_t TranspositionTable::generation() const { return generation8; }
 // to be replaced later. The replace value of an entry is calculated as its depth
 // minus 8 times its relative age. TTEntry t1 is considered more valuable than
 // TTEntry t2 if its replace value is greater than that of t2.
-std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key) const {
+template<typename Layout>
+std::tuple<bool, TTData, TTWriter<Layout>>
+BasicTranspositionTable<Layout>::probe(const Key key) const {
+
+    using KeyType = typename Layout::KeyType;
+
+    Cluster&      cluster  = table[mul_hi64(key, clusterCount)];
+    Entry* const  tte      = cluster.entry;
+    const KeyType shortKey = KeyType(key);  // Use the low bits as key inside the cluster
+
+    count(&TTStats::probes);
 
-    TTEntry* const tte   = first_entry(key);
-    const uint16_t key16 = uint16_t(key);  // Use the low 16 bits as key inside the cluster
+    // The entries of the previous game are gone after a lazy clear, see lazy_clear().
+    // Once the sweep is done all the clusters are current, so their epoch isn't read.
+    if (!sweepDone.load(std::memory_order_acquire)
+        && cluster.epoch.load(std::memory_order_relaxed) != epoch8)
+        empty_stale(cluster,
+                    occupancy ? &occupancy[std::min(ttThreadIndex, occupancyShards - 1)] : nullptr);
+
+    // In a deterministic search, the positions written by the thread since the last
+    // synchronization are read from its buffer. The writer is found as usual.
+    const TTWriteBuffer::Entry* const buffered =
+      ttThreadBuffer ? ttThreadBuffer->find(key) : nullptr;
+
+    if (buffered)
+        count(&TTStats::hits);
+
+    for (int i = 0; i < Layout::ClusterSize; ++i)
+        if (tte[i].key == shortKey)
+        {
+            const TTWriter<Layout> ttWriter = writer(&tte[i]);
+
+            if (buffered)
+                return {true, buffered->read(), ttWriter};
+
+            if (tte[i].is_occupied())
+            {
+                count(&TTStats::hits);
+#if defined(TT_STATS) && !defined(NDEBUG)
+                if (*ttWriter.fullKey && *ttWriter.fullKey != key)
+                    count(&TTStats::collisions);
+#endif
+            }
 
-    for (int i = 0; i < ClusterSize; ++i)
-        if (tte[i].key16 == key16)
             // This gap is the main place for read races.
             // After `read()` completes that copy is final, but may be self-inconsistent.
-            return {tte[i].is_occupied(), tte[i].read(), TTWriter(&tte[i])};
+            return {tte[i].is_occupied(), tte[i].read(), ttWriter};
+        }
 
     // Find an entry to be replaced according to the replacement strategy
-    TTEntry* replace = tte;
-    for (int i = 1; i < ClusterSize; ++i)
+    Entry* replace = tte;
+    for (int i = 1; i < Layout::ClusterSize; ++i)
         if (replace->depth8 - replace->relative_age(generation8)
             > tte[i].depth8 - tte[i].relative_age(generation8))
             replace = &tte[i];
 
+    if (buffered)
+        return {true, buffered->read(), writer(replace)};
+
     return {false,
             TTData{Move::none(), VALUE_NONE, VALUE_NONE, DEPTH_ENTRY_OFFSET, BOUND_NONE, false},
-            TTWriter(replace)};
+            writer(replace)};
 }
 
 
-TTEntry* TranspositionTable::first_entry(const Key key) const {
+template<typename Layout>
+typename BasicTranspositionTable<Layout>::Entry*
+BasicTranspositionTable<Layout>::first_entry(const Key key) const {
     return &table[mul_hi64(key, clusterCount)].entry[0];
 }
 
+
+template<typename Layout>
+TTWriter<Layout> BasicTranspositionTable<Layout>::writer(Entry* tte) const {
+    TTOccupancy* const shard =
+      occupancy ? &occupancy[std::min(ttThreadIndex, occupancyShards - 1)] : nullptr;
+
+#if defined(TT_STATS) && !defined(NDEBUG)
+    // Entries are numbered cluster by cluster, skipping the padding
+    const size_t offset = reinterpret_cast<char*>(tte) - reinterpret_cast<char*>(table);
+    const size_t index  = offset / sizeof(Cluster) * Layout::ClusterSize
+                       + offset % sizeof(Cluster) / sizeof(Entry);
+
+    return TTWriter<Layout>(tte, shard, &fullKeys[index]);
+#else
+    return TTWriter<Layout>(tte, shard);
+#endif
+}
+
+
+// Replays the writes of the buffer in the order they were first made, each one
+// with the last data written for its position. The calling thread must not have
+// its writes deferred while doing so, but may be a thread of the search.
+template<typename Layout>
+void BasicTranspositionTable<Layout>::apply(TTWriteBuffer& buffer) {
+
+    TTWriteBuffer* const threadBuffer = ttThreadBuffer;
+    ttThreadBuffer                    = nullptr;
+
+    for (size_t i = 0; i < buffer.count; ++i)
+    {
+        const TTWriteBuffer::Entry& e = buffer.entries[i];
+        const TTData                d = e.read();
+
+        auto [ttHit, ttData, ttWriter] = probe(e.key);
+        ttWriter.write(e.key, d.value, d.is_pv, d.bound, d.depth, d.move, d.eval,
+                       e.genBound8 & GENERATION_MASK);
+    }
+
+    ttThreadBuffer = threadBuffer;
+    buffer.clear();
+}
+
+
+TTWriteBuffer::TTWriteBuffer()  = default;
+TTWriteBuffer::~TTWriteBuffer() = default;
+
+void TTWriteBuffer::resize(size_t newCapacity) {
+
+    size_t n = 1;
+    while (n < newCapacity)
+        n *= 2;
+
+    if (n != capacity)
+    {
+        capacity = n;
+        entries  = std::make_unique<Entry[]>(capacity);
+        index    = std::make_unique<uint32_t[]>(2 * capacity);
+    }
+
+    count = 0;
+    std::memset(index.get(), 0, 2 * capacity * sizeof(uint32_t));
+}
+
+void TTWriteBuffer::clear() {
+    if (count)
+        std::memset(index.get(), 0, 2 * capacity * sizeof(uint32_t));
+    count = 0;
+}
+
+TTWriteBuffer::Entry* TTWriteBuffer::find(Key key) const {
+
+    // The index is at most half full, so that probing sequences are short
+    for (size_t i = key & (2 * capacity - 1); index[i]; i = (i + 1) & (2 * capacity - 1))
+        if (entries[index[i] - 1].key == key)
+            return &entries[index[i] - 1];
+
+    return nullptr;
+}
+
+TTWriteBuffer::Entry* TTWriteBuffer::insert(Key key) {
+
+    if (count == capacity)
+        return nullptr;
+
+    size_t i = key & (2 * capacity - 1);
+    while (index[i])
+        i = (i + 1) & (2 * capacity - 1);
+
+    Entry& e = entries[count];
+    index[i] = uint32_t(++count);
+
+    e.key       = key;
+    e.depth8    = 0;
+    e.genBound8 = 0;
+    e.move16    = Move::none();
+    return &e;
+}
+
+
+template struct TTWriter<TTLayoutCompact>;
+template struct TTWriter<TTLayoutCacheLine>;
+template struct TTWriter<TTLayoutLongKey>;
+
+template class BasicTranspositionTable<TTLayoutCompact>;
+template class BasicTranspositionTable<TTLayoutCacheLine>;
+template class BasicTranspositionTable<TTLayoutLongKey>;
+
 }  // namespace Stockfish
@@ -19,18 +19,29 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
 #include <tuple>
 
 #include "memory.h"
+#include "misc.h"
+#include "thread_win32_osx.h"
 #include "types.h"
 
 namespace Stockfish {
 
 class ThreadPool;
+template<typename KeyType>
 struct TTEntry;
-struct Cluster;
+template<typename Layout>
+struct TTCluster;
+template<typename Layout>
+class BasicTranspositionTable;
+struct SharedTTHeader;
 
 // There is only one global hash table for the engine and all its threads. For chess in particular, we even allow racy
 // updates between threads to and from the TT, as taking the time to synchronize access would cost thinking time and
@@ -66,45 +77,226 @@ struct TTData {
 };
 
 
+// How the pages of the table are spread over the NUMA nodes the search threads are bound to.
+// With Auto, each thread first touches one contiguous slice of the table. With Interleave,
+// consecutive large pages are placed round-robin on the nodes, so that every node serves an
+// equal share of the probes no matter where the position hashes to.
+enum class TTPlacement {
+    Auto,
+    Interleave
+};
+
+
+// The layouts of the table. A layout gives the number of low key bits kept in each entry to
+// verify a probe, how many entries make up a cluster, and the size of a cluster, which should
+// divide the size of a cache line. The layout of the engine's table is selected at compile
+// time, see TranspositionTable below; the others are kept for benchmarking.
+struct TTLayoutCompact {  // 3 entries with 16-bit keys in half a cache line (default)
+    using KeyType                             = uint16_t;
+    static constexpr int         ClusterSize  = 3;
+    static constexpr std::size_t ClusterBytes = 32;
+    static constexpr const char* Name         = "compact";
+};
+
+struct TTLayoutCacheLine {  // 6 entries with 16-bit keys in a cache line
+    using KeyType                             = uint16_t;
+    static constexpr int         ClusterSize  = 6;
+    static constexpr std::size_t ClusterBytes = 64;
+    static constexpr const char* Name         = "cacheline";
+};
+
+struct TTLayoutLongKey {  // 5 entries with 32-bit keys in a cache line
+    using KeyType                             = uint32_t;
+    static constexpr int         ClusterSize  = 5;
+    static constexpr std::size_t ClusterBytes = 64;
+    static constexpr const char* Name         = "longkey";
+};
+
+
+// Counters of the table activity of one search thread. They are only updated in builds with
+// `make ttstats=yes`, and collisions only in debug builds, which keep the full key of every
+// entry to tell them apart from genuine hits.
+struct TTStats {
+    StatCounter probes;
+    StatCounter hits;
+    StatCounter collisions;         // Hits on an entry written by another position
+    StatCounter writes;
+    StatCounter fills;              // Writes to an empty entry
+    StatCounter updates;            // Writes overwriting the same position
+    StatCounter ageReplacements;    // Writes replacing a position of an older search
+    StatCounter depthReplacements;  // Writes replacing a position of the current search
+    StatCounter depthDecrements;    // Writes dropped for a deeper entry, which loses a ply
+
+    TTStats& operator+=(const TTStats& s);
+};
+
+std::ostream& operator<<(std::ostream& os, const TTStats& s);
+
+#ifdef TT_STATS
+// The counters of the calling thread, if it is a search thread
+inline thread_local TTStats* ttThreadStats = nullptr;
+#endif
+
+
+// The number of occupied entries of each generation, as changed by the writes of one thread.
+// A shard can go negative when its thread overwrites entries counted by another one, only the
+// sum over all the shards is meaningful. Only the owner thread updates a shard, so that plain
+// relaxed loads and stores are enough and the writes of the threads never contend.
+struct alignas(64) TTOccupancy {
+    std::atomic<int64_t> entries[32];  // Indexed by the generation bits of genBound8
+};
+
+// The index of the calling thread in the thread pool, if it is a search thread. Others
+// update the last shard of the table.
+inline thread_local size_t ttThreadIndex = SIZE_MAX;
+
+
+// The writes of one search thread between two synchronizations of a deterministic
+// search, see the DeterministicSearch option. The thread reads its own writes back
+// from here, and the table applies the buffers of all the threads in a fixed order
+// while the threads wait, so that the table doesn't depend on their scheduling.
+class TTWriteBuffer {
+   public:
+    TTWriteBuffer();
+    ~TTWriteBuffer();
+
+    void resize(size_t capacity);  // Number of positions kept, rounded up to a power of two
+    void clear();
+    bool empty() const { return count == 0; }
+
+   private:
+    template<typename Layout>
+    friend class BasicTranspositionTable;
+    template<typename Layout>
+    friend struct TTWriter;
+
+    using Entry = TTEntry<Key>;  // Keeps the full key of the position
+
+    Entry* find(Key key) const;
+    Entry* insert(Key key);  // nullptr when the buffer is full
+
+    std::unique_ptr<Entry[]>    entries;  // In order of the first write
+    std::unique_ptr<uint32_t[]> index;    // Open addressing on the key, 1 + entry, 0 if empty
+    size_t                      capacity = 0, count = 0;
+};
+
+// The buffer of the calling thread, if its writes must be deferred
+inline thread_local TTWriteBuffer* ttThreadBuffer = nullptr;
+
+
 // This is used to make racy writes to the global TT.
+template<typename Layout>
 struct TTWriter {
    public:
     void write(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
 
    private:
-    friend class TranspositionTable;
-    TTEntry* entry;
-    TTWriter(TTEntry* tte);
+    using Entry = TTEntry<typename Layout::KeyType>;
+
+    friend class BasicTranspositionTable<Layout>;
+    Entry*       entry;
+    TTOccupancy* occupancy;  // Shard of the writing thread, nullptr if not tracked
+#if defined(TT_STATS) && !defined(NDEBUG)
+    Key* fullKey;
+    TTWriter(Entry* tte, TTOccupancy* occ, Key* fk);
+#else
+    TTWriter(Entry* tte, TTOccupancy* occ);
+#endif
 };
 
 
-class TranspositionTable {
+template<typename Layout>
+class BasicTranspositionTable {
+
+    using Entry   = TTEntry<typename Layout::KeyType>;
+    using Cluster = TTCluster<Layout>;
 
    public:
-    ~TranspositionTable() { aligned_large_pages_free(table); }
+    ~BasicTranspositionTable() {
+        finish_lazy_clear();
+        deallocate();
+    }
 
-    void resize(size_t mbSize, ThreadPool& threads);  // Set TT size
-    void clear(ThreadPool& threads);                  // Re-initialize memory, multithreaded
+    void resize(size_t             mbSize,
+                ThreadPool&        threads,
+                const std::string& newSharedName = "",
+                TTPlacement        placement     = TTPlacement::Auto);  // Set size, keeps contents
+    bool is_shared() const { return sharedHeader != nullptr; }
+    void clear(ThreadPool& threads);                  // Re-initialize memory, not if shared
+    void lazy_clear();                                // Empty at once, zero in background
     int  hashfull(int maxAge = 0)
       const;  // Approximate what fraction of entries (permille) have been written to during this root search
 
     void
     new_search();  // This must be called at the beginning of each root search to track entry aging
     uint8_t generation() const;  // The current age, used when writing new data to the TT
-    std::tuple<bool, TTData, TTWriter>
+    std::tuple<bool, TTData, TTWriter<Layout>>
     probe(const Key key) const;  // The main method, whose retvals separate local vs global objects
-    TTEntry* first_entry(const Key key)
+    Entry* first_entry(const Key key)
       const;  // This is the hash function; its only external use is memory prefetching.
+    void apply(TTWriteBuffer& buffer);  // Replay and clear the writes of a deterministic search
+
+    bool save(const std::string& filename);  // Dump the table contents to a file
+    bool load(const std::string& filename,
+              ThreadPool&        threads);  // Restore a previously saved table, multithreaded
+
+    // Size of the large pages backing the table, 0 for default pages
+    size_t page_size() const { return large_page_size(table); }
 
    private:
-    friend struct TTEntry;
+    void             deallocate();
+    TTWriter<Layout> writer(Entry* tte) const;
+    void             migrate(const Cluster* oldTable, size_t oldClusterCount, ThreadPool& threads);
+    void             sweep();
+    void             empty_stale(Cluster& cluster, TTOccupancy* shard) const;
+    void             finish_lazy_clear();
+    void             count_occupied(size_t start, size_t len, TTOccupancy& shard);
+    void             recount_occupancy(ThreadPool& threads);
+    int              sampled_hashfull(int maxAge) const;
+
+    size_t      clusterCount = 0;
+    Cluster*    table     = nullptr;
+    TTPlacement placement = TTPlacement::Auto;
 
-    size_t   clusterCount;
-    Cluster* table = nullptr;
+    // Set when the table lives in a shared memory object, see resize()
+    SharedTTHeader* sharedHeader = nullptr;
+    std::string     sharedName;
 
     uint8_t generation8 = 0;  // Size must be not bigger than TTEntry::genBound8
+
+    // Occupancy counters, one shard per thread of the pool plus one for the other threads.
+    // They make hashfull() exact and cheap, but aren't kept for shared tables.
+    std::unique_ptr<TTOccupancy[]> occupancy;
+    size_t                         occupancyShards = 0;
+
+    // State of a lazy clear, see lazy_clear(). Clusters of another epoch are treated as empty.
+    uint8_t                       epoch8 = 0;
+    std::atomic<bool>             sweepDone{true};
+    std::unique_ptr<NativeThread> sweeper;
+
+#if defined(TT_STATS) && !defined(NDEBUG)
+    // The full key of the position that last wrote each entry, zero when unknown
+    std::unique_ptr<Key[]> fullKeys;
+#endif
 };
 
+// The layouts are instantiated in tt.cpp
+extern template class BasicTranspositionTable<TTLayoutCompact>;
+extern template class BasicTranspositionTable<TTLayoutCacheLine>;
+extern template class BasicTranspositionTable<TTLayoutLongKey>;
+
+
+// The table used by the search, its layout is chosen with `make ttlayout=...`
+#if defined(TT_LAYOUT_CACHELINE)
+using TTLayout = TTLayoutCacheLine;
+#elif defined(TT_LAYOUT_LONGKEY)
+using TTLayout = TTLayoutLongKey;
+#else
+using TTLayout = TTLayoutCompact;
+#endif
+
+class TranspositionTable: public BasicTranspositionTable<TTLayout> {};
+
 }  // namespace Stockfish
 
 #endif  // #ifndef TT_H_INCLUDED
@@ -22,6 +22,7 @@
 #include <cctype>
 #include <cmath>
 #include <cstdint>
+#include <iomanip>
 #include <iterator>
 #include <optional>
 #include <sstream>
@@ -61,6 +62,9 @@ void UCIEngine::print_info_string(std::string_view str) {
             std::cout << "info string " << line << '\n';
         }
     }
+    // A network loading in the background reports from its thread, and no other
+    // output may follow for a while
+    std::cout << std::flush;
     sync_cout_end();
 }
 
@@ -144,13 +148,47 @@ void UCIEngine::loop() {
             bench(is);
         else if (token == BenchmarkCommand)
             benchmark(is);
+        else if (token == "smpbench")
+            smp_benchmark(is);
+        else if (token == "ttbench")
+        {
+            // ttbench [Hash in MB] [depth]
+            std::string mbSize, depth;
+
+            mbSize = (is >> mbSize) ? mbSize : "16";
+            depth  = (is >> depth) ? depth : "4";
+            engine.benchmark_tt_layouts(std::stoi(mbSize), std::stoi(depth));
+        }
+        else if (token == "nnuebench")
+        {
+            // nnuebench [repetitions]
+            std::string repetitions;
+
+            repetitions = (is >> repetitions) ? repetitions : "100";
+            engine.benchmark_nnue(std::max(std::stoi(repetitions), 1));
+        }
+        else if (token == "ttstats")
+            stats_command<TTStats>(is);
+        else if (token == "evalcache")
+            stats_command<Eval::EvalCacheStats>(is);
+        else if (token == "nnuestats")
+            stats_command<Eval::NNUE::NnueStats>(is);
         else if (token == "d")
             sync_cout << engine.visualize() << sync_endl;
         else if (token == "eval")
             engine.trace_eval();
+        else if (token == "evalfens")
+        {
+            // evalfens [batch size], then one FEN per line until "end"
+            std::string batchSize;
+
+            batchSize = (is >> batchSize) ? batchSize : "4096";
+            engine.evaluate_fens(std::cin, std::max(std::stoi(batchSize), 1));
+        }
         else if (token == "compiler")
-            sync_cout << compiler_info() << sync_endl;
-        else if (token == "export_net")
+            sync_cout << compiler_info() << "Page sizes                 : "
+                      << engine.page_size_information_as_string() << sync_endl;
+        else if (token == "export_net" || token == "export_mapped_net")
         {
             std::pair<std::optional<std::string>, std::string> files[2];
 
@@ -160,7 +198,21 @@ void UCIEngine::loop() {
             if (is >> std::skipws >> files[1].second)
                 files[1].first = files[1].second;
 
-            engine.save_network(files);
+            if (token == "export_net")
+                engine.save_network(files);
+            else
+                engine.save_mapped_network(files);
+        }
+        else if (token == "save_hash" || token == "load_hash")
+        {
+            std::string file;
+
+            if (!(is >> std::skipws >> file))
+                sync_cout << "No file specified for " << token << sync_endl;
+            else if (token == "save_hash")
+                engine.save_hash(file);
+            else
+                engine.load_hash(file);
         }
         else if (token == "--help" || token == "help" || token == "--license" || token == "license")
             sync_cout
@@ -178,6 +230,18 @@ void UCIEngine::loop() {
     } while (token != "quit" && cli.argc == 1);  // The command-line arguments are one-shot
 }
 
+// The ttstats, evalcache and nnuestats commands print the statistics of type T, or
+// clear them when followed by "clear"
+template<typename T>
+void UCIEngine::stats_command(std::istream& is) {
+    std::string action;
+
+    if (is >> std::skipws >> action && action == "clear")
+        engine.clear_stats<T>();
+    else
+        sync_cout << engine.stats_as_string<T>() << sync_endl;
+}
+
 Search::LimitsType UCIEngine::parse_limits(std::istream& is) {
     Search::LimitsType limits;
     std::string        token;
@@ -363,8 +427,11 @@ void UCIEngine::benchmark(std::istream& args) {
 
     std::cerr << "\n";
 
-    cnt   = 1;
-    nodes = 0;
+    // The warmup is not measured
+    nodes     = 0;
+    totalTime = 0;
+
+    uint64_t syncTime = 0;
 
     int           numHashfullReadings = 0;
     constexpr int hashfullAges[]      = {0, 999};  // Only normal hashfull and touched hash.
@@ -382,41 +449,79 @@ void UCIEngine::benchmark(std::istream& args) {
         }
     };
 
-    engine.search_clear();  // search_clear may take a while
+    // Searches all the positions, afterSearch() is called with the time of each search
+    auto searchPositions = [&](std::string_view label, auto&& afterSearch) {
+        cnt = 1;
 
-    for (const auto& cmd : setup.commands)
-    {
-        std::istringstream is(cmd);
-        is >> std::skipws >> token;
+        engine.search_clear();  // search_clear may take a while
 
-        if (token == "go")
+        for (const auto& cmd : setup.commands)
         {
-            // One new line is produced by the search, so omit it here
-            std::cerr << "\rPosition " << cnt++ << '/' << numGoCommands;
+            std::istringstream is(cmd);
+            is >> std::skipws >> token;
 
-            Search::LimitsType limits = parse_limits(is);
+            if (token == "go")
+            {
+                // One new line is produced by the search, so omit it here
+                std::cerr << '\r' << label << ' ' << cnt++ << '/' << numGoCommands;
 
-            TimePoint elapsed = now();
+                Search::LimitsType limits = parse_limits(is);
 
-            // Run with silenced network verification
-            engine.go(limits);
-            engine.wait_for_search_finished();
+                TimePoint elapsed = now();
 
-            totalTime += now() - elapsed;
+                // Run with silenced network verification
+                engine.go(limits);
+                engine.wait_for_search_finished();
 
-            updateHashfullReadings();
+                afterSearch(now() - elapsed);
 
-            nodes += nodesSearched;
-            nodesSearched = 0;
-        }
-        else if (token == "position")
-            position(is);
-        else if (token == "ucinewgame")
-        {
-            engine.search_clear();  // search_clear may take a while
+                nodesSearched = 0;
+            }
+            else if (token == "position")
+                position(is);
+            else if (token == "ucinewgame")
+            {
+                engine.search_clear();  // search_clear may take a while
+            }
         }
+    };
+
+    // A deterministic search is compared with the same positions searched without the
+    // synchronizations, before the measured run so that its statistics aren't mixed in
+    const bool deterministicSearch =
+      engine.get_options()["DeterministicSearch"] && setup.threads > 1;
+    uint64_t  freeNodes = 0;
+    TimePoint freeTime  = 0;
+
+    if (deterministicSearch)
+    {
+        ss = std::istringstream("name DeterministicSearch value false");
+        setoption(ss);
+
+        searchPositions("Position without synchronization", [&](TimePoint elapsed) {
+            freeTime += elapsed;
+            freeNodes += nodesSearched;
+        });
+
+        std::cerr << "\n";
+
+        ss = std::istringstream("name DeterministicSearch value true");
+        setoption(ss);
     }
 
+    engine.clear_stats<TTStats>();
+    engine.clear_stats<Eval::EvalCacheStats>();
+    engine.clear_stats<Eval::NNUE::NnueStats>();
+
+    searchPositions("Position", [&](TimePoint elapsed) {
+        totalTime += elapsed;
+        syncTime += engine.get_sync_time();
+
+        updateHashfullReadings();
+
+        nodes += nodesSearched;
+    });
+
     totalTime = std::max<TimePoint>(totalTime, 1);  // Ensure positivity to avoid a 'divide by zero'
 
     dbg_print();
@@ -427,6 +532,15 @@ void UCIEngine::benchmark(std::istream& args) {
       std::size(hashfullAges) == 2 && hashfullAges[0] == 0 && hashfullAges[1] == 999,
       "Hardcoded for display. Would complicate the code needlessly in the current state.");
 
+    // In a deterministic search the threads lose the time they spend synchronizing
+    std::stringstream deterministic;
+    if (deterministicSearch)
+        deterministic << "yes, " << std::fixed << std::setprecision(1)
+                      << 100.0 * syncTime / (1000.0 * totalTime * setup.threads)
+                      << "% of the thread time synchronizing";
+    else
+        deterministic << "no";
+
     std::string threadBinding = engine.thread_binding_information_as_string();
     if (threadBinding.empty())
         threadBinding = "none";
@@ -439,13 +553,19 @@ void UCIEngine::benchmark(std::istream& args) {
               // "\nCompiled by                : "
               << compiler_info()
               << "Large pages                : " << (has_large_pages() ? "yes" : "no")
+              << "\nPage sizes                 : " << engine.page_size_information_as_string()
               << "\nUser invocation            : " << BenchmarkCommand << " "
               << setup.originalInvocation << "\nFilled invocation          : " << BenchmarkCommand
               << " " << setup.filledInvocation
               << "\nAvailable processors       : " << engine.get_numa_config_as_string()
               << "\nThread count               : " << setup.threads
               << "\nThread binding             : " << threadBinding
+              << "\nDeterministic search       : " << deterministic.str()
               << "\nTT size [MiB]              : " << setup.ttSize
+              << "\nTT layout                  : " << TTLayout::Name
+              << "\nSmall net only             : "
+              << (engine.get_options()["SmallNetOnly"] ? "yes" : "no")
+              << "\nNNUE memory/thread [KiB]   : " << engine.nnue_memory_per_thread() / 1024
               << "\nHash max, avg [per mille]  : "
               << "\n    single search          : " << maxHashfull[0] << ", "
               << totalHashfull[0] / numHashfullReadings
@@ -453,15 +573,221 @@ void UCIEngine::benchmark(std::istream& args) {
               << totalHashfull[1] / numHashfullReadings
               << "\nTotal nodes searched       : " << nodes
               << "\nTotal search time [s]      : " << totalTime / 1000.0
-              << "\nNodes/second               : " << 1000 * nodes / totalTime << std::endl;
+              << "\nNodes/second               : " << 1000 * nodes / totalTime;
+
+    if (deterministicSearch)
+        std::cerr << "\nNodes/second, no sync      : "
+                  << 1000 * freeNodes / std::max<TimePoint>(freeTime, 1);
+
+    std::cerr << std::endl;
 
     // clang-format on
 
+#ifdef TT_STATS
+    std::cerr << engine.stats_as_string<TTStats>() << std::endl;
+#endif
+#ifdef EVAL_CACHE_STATS
+    std::cerr << engine.stats_as_string<Eval::EvalCacheStats>() << std::endl;
+#endif
+#ifdef NNUE_STATS
+    std::cerr << engine.stats_as_string<Eval::NNUE::NnueStats>() << std::endl;
+#endif
+
+    init_search_update_listeners();
+}
+
+// Measures how the search scales with the number of threads. The bench positions
+// are searched to a fixed depth with 1, 2, 4, ... up to the given number of threads,
+// and for each thread count the time and nodes needed to complete every depth, the
+// hashfull after it, and the agreement of the best move with a deeper single-thread
+// search are printed as JSON.
+// smpbench [max threads] [depth] [Hash in MB] [positions]
+void UCIEngine::smp_benchmark(std::istream& args) {
+
+    static constexpr int ReferenceExtraDepth = 4;
+
+    struct DepthResult {
+        std::uint64_t timeMs = 0, nodes = 0, hashfull = 0;
+    };
+
+    struct PositionResult {
+        std::string              bestMove;
+        std::vector<DepthResult> depths;
+    };
+
+    std::size_t maxThreads, numPositions;
+    Depth       depth;
+    int         ttSize;
+
+    if (!(args >> maxThreads))
+        maxThreads = get_hardware_concurrency();
+    if (!(args >> depth))
+        depth = 13;
+    if (!(args >> ttSize))
+        ttSize = 16 * int(maxThreads);
+
+    std::vector<std::string> fens = Benchmark::default_fens();
+
+    if (args >> numPositions && numPositions < fens.size())
+        fens.resize(numPositions);
+
+    maxThreads = std::max<std::size_t>(maxThreads, 1);
+    depth      = std::clamp(depth, 1, MAX_PLY - 1 - ReferenceExtraDepth);
+
+    std::vector<std::size_t> threadCounts;
+    for (std::size_t t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    PositionResult current;
+
+    engine.set_on_update_full([&](const Engine::InfoFull& i) {
+        if (i.depth <= int(current.depths.size()))
+            current.depths[i.depth - 1] = {i.timeMs, i.nodes, std::uint64_t(i.hashfull)};
+    });
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_bestmove([&](std::string_view bestMove, std::string_view) {
+        current.bestMove = bestMove;
+    });
+    engine.set_on_verify_networks([](const auto&) {});
+
+    auto set = [&](const std::string& name, const std::string& value) {
+        std::istringstream is("name " + name + " value " + value);
+        setoption(is);
+    };
+
+    auto search_fen = [&](const std::string& fen, Depth d) {
+        std::istringstream is("fen " + fen);
+        Search::LimitsType limits;
+
+        current = {{}, std::vector<DepthResult>(d)};
+
+        engine.search_clear();
+        position(is);
+
+        limits.depth     = d;
+        limits.startTime = now();
+        engine.go(limits);
+        engine.wait_for_search_finished();
+
+        // Depths that were not reported, when the search ended early, count as
+        // completed with the last reported one.
+        for (std::size_t i = 1; i < current.depths.size(); ++i)
+            if (!current.depths[i].nodes)
+                current.depths[i] = current.depths[i - 1];
+
+        return current;
+    };
+
+    set("Hash", std::to_string(ttSize));
+    set("UCI_Chess960", "false");
+
+    // Reference best moves, searched deeper with a single thread
+    std::vector<std::string> references;
+
+    set("Threads", "1");
+    for (std::size_t i = 0; i < fens.size(); ++i)
+    {
+        std::cerr << "\rReference position " << i + 1 << '/' << fens.size() << std::flush;
+        references.push_back(search_fen(fens[i], depth + ReferenceExtraDepth).bestMove);
+    }
+    std::cerr << std::endl;
+
+    std::ostringstream json;
+    std::uint64_t      singleThreadTime = 0;
+
+    json << "{\n  \"depth\": " << depth << ",\n  \"reference_depth\": "
+         << depth + ReferenceExtraDepth << ",\n  \"hash\": " << ttSize
+         << ",\n  \"positions\": [";
+
+    for (std::size_t i = 0; i < fens.size(); ++i)
+        json << (i ? "," : "") << "\n    {\"fen\": \"" << fens[i] << "\", \"reference\": \""
+             << references[i] << "\"}";
+
+    json << "\n  ],\n  \"runs\": [";
+
+    for (std::size_t t : threadCounts)
+    {
+        std::vector<DepthResult> total(depth);
+        std::vector<std::string> bestMoves;
+        std::size_t              agreements = 0;
+
+        set("Threads", std::to_string(t));
+
+        for (std::size_t i = 0; i < fens.size(); ++i)
+        {
+            std::cerr << "\rThreads " << t << ", position " << i + 1 << '/' << fens.size()
+                      << std::flush;
+
+            PositionResult result = search_fen(fens[i], depth);
+
+            for (Depth d = 0; d < depth; ++d)
+            {
+                total[d].timeMs += result.depths[d].timeMs;
+                total[d].nodes += result.depths[d].nodes;
+                total[d].hashfull += result.depths[d].hashfull;
+            }
+
+            agreements += result.bestMove == references[i];
+            bestMoves.push_back(result.bestMove);
+        }
+
+        const std::uint64_t timeMs = std::max<std::uint64_t>(total[depth - 1].timeMs, 1);
+        const std::uint64_t nodes  = total[depth - 1].nodes;
+
+        if (t == 1)
+            singleThreadTime = timeMs;
+
+        json << (t == 1 ? "" : ",") << "\n    {\n      \"threads\": " << t
+             << ",\n      \"time_ms\": " << timeMs << ",\n      \"nodes\": " << nodes
+             << ",\n      \"nps\": " << 1000 * nodes / timeMs
+             << ",\n      \"speedup\": " << double(singleThreadTime) / timeMs
+             << ",\n      \"best_move_agreement\": " << double(agreements) / fens.size()
+             << ",\n      \"best_moves\": [";
+
+        for (std::size_t i = 0; i < bestMoves.size(); ++i)
+            json << (i ? ", " : "") << "\"" << bestMoves[i] << "\"";
+
+        json << "],\n      \"depths\": [";
+
+        for (Depth d = 0; d < depth; ++d)
+            json << (d ? "," : "") << "\n        {\"depth\": " << d + 1
+                 << ", \"time_ms\": " << total[d].timeMs << ", \"nodes\": " << total[d].nodes
+                 << ", \"hashfull\": " << total[d].hashfull / fens.size() << "}";
+
+        json << "\n      ]\n    }";
+    }
+
+    json << "\n  ]\n}";
+
+    std::cerr << std::endl;
+
+    sync_cout << json.str() << sync_endl;
+
     init_search_update_listeners();
 }
 
 void UCIEngine::setoption(std::istringstream& is) {
-    engine.wait_for_search_finished();
+    std::string token, name;
+    const auto  start = is.tellg();
+
+    is >> token;  // Consume the "name" token
+    while (is >> token && token != "value")
+        name += (name.empty() ? "" : " ") + token;
+
+    is.clear();
+    is.seekg(start);
+
+    auto is_named = [&name](const std::string& s) {
+        return !CaseInsensitiveLess()(name, s) && !CaseInsensitiveLess()(s, name);
+    };
+
+    // With HotSwapNetworks the networks are loaded in the background, while searching
+    if (!engine.get_options()["HotSwapNetworks"]
+        || !(is_named("EvalFile") || is_named("EvalFileSmall")))
+        engine.wait_for_search_finished();
+
     engine.get_options().setoption(is);
 }
 
@@ -148,6 +148,30 @@ class TestCLI(metaclass=OrderedClassMembers):
         )
         assert self.stockfish.process.returncode == 0
 
+    def test_ttbench_16_2(self):
+        self.stockfish = Stockfish("ttbench 16 2".split(" "), True)
+        assert self.stockfish.process.returncode == 0
+
+    def test_ttstats(self):
+        self.stockfish = Stockfish("ttstats".split(" "), True)
+        assert self.stockfish.process.returncode == 0
+
+    def test_evalcache(self):
+        self.stockfish = Stockfish("evalcache".split(" "), True)
+        assert self.stockfish.process.returncode == 0
+
+    def test_nnuestats(self):
+        self.stockfish = Stockfish("nnuestats".split(" "), True)
+        assert self.stockfish.process.returncode == 0
+
+    def test_nnuebench(self):
+        self.stockfish = Stockfish("nnuebench 2".split(" "), True)
+        assert self.stockfish.process.returncode == 0
+
+    def test_smpbench(self):
+        self.stockfish = Stockfish("smpbench 2 4 16 2".split(" "), True)
+        assert self.stockfish.process.returncode == 0
+
     def test_d(self):
         self.stockfish = Stockfish("d".split(" "), True)
         assert self.stockfish.process.returncode == 0
@@ -289,9 +313,103 @@ class TestInteractive(metaclass=OrderedClassMembers):
 
         self.stockfish.check_output(callback)
 
+    def test_evalfens(self):
+        self.stockfish.send_command("evalfens 2")
+        self.stockfish.send_command(
+            "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+        )
+        self.stockfish.send_command("4k3/8/8/8/8/8/4r3/4K3 w - - 0 1")
+        self.stockfish.send_command("8/8/4k3/8/8/4K3/4P3/8 b - - 0 1")
+        self.stockfish.send_command("end")
+
+        scores = []
+
+        def callback(output):
+            if output.startswith("info string"):
+                return False
+            assert re.match(r"^(-?\d+|none)$", output)
+            scores.append(output)
+            return len(scores) == 3
+
+        self.stockfish.check_output(callback)
+        assert scores[1] == "none"
+
     def test_clear_hash(self):
         self.stockfish.send_command("setoption name Clear Hash")
 
+    def test_lazy_hash_clear(self):
+        def search_nodes():
+            self.stockfish.send_command("position startpos")
+            self.stockfish.clear_output()
+            self.stockfish.send_command("go depth 10")
+            self.stockfish.starts_with("bestmove")
+            return [
+                line.split(" nodes ")[1].split()[0]
+                for line in self.stockfish.get_output()
+                if line.startswith("info depth")
+            ][-1]
+
+        self.stockfish.send_command("setoption name Hash value 256")
+        self.stockfish.send_command("ucinewgame")
+        nodes = search_nodes()
+
+        # Age the entries of that search through a whole cycle of generations
+        self.stockfish.send_command("setoption name LazyHashClear value true")
+        self.stockfish.send_command(
+            "position fen r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"
+        )
+        for _ in range(31):
+            self.stockfish.send_command("go depth 1")
+            self.stockfish.starts_with("bestmove")
+
+        # None of them must be found after the clear
+        self.stockfish.send_command("ucinewgame")
+        assert search_nodes() == nodes
+
+        self.stockfish.send_command("setoption name LazyHashClear value false")
+        self.stockfish.send_command("setoption name Hash value 16")
+
+    def test_hash_resize_keeps_entries(self):
+        def search_nodes():
+            self.stockfish.send_command("position startpos")
+            self.stockfish.clear_output()
+            self.stockfish.send_command("go depth 10")
+            self.stockfish.starts_with("bestmove")
+            return [
+                line.split(" nodes ")[1].split()[0]
+                for line in self.stockfish.get_output()
+                if line.startswith("info depth")
+            ][-1]
+
+        self.stockfish.send_command("setoption name Hash value 16")
+        self.stockfish.send_command("ucinewgame")
+        nodes = search_nodes()
+
+        # The entries of the first search must be found after the resize
+        self.stockfish.send_command("setoption name Hash value 32")
+        migrated = search_nodes()
+        assert migrated != nodes
+
+        # And the migration doesn't depend on anything but the old table
+        self.stockfish.send_command("setoption name Hash value 16")
+        self.stockfish.send_command("ucinewgame")
+        assert search_nodes() == nodes
+        self.stockfish.send_command("setoption name Hash value 32")
+        assert search_nodes() == migrated
+
+        self.stockfish.send_command("setoption name Hash value 16")
+
+    def test_save_and_load_hash(self):
+        self.stockfish.send_command("ucinewgame")
+        self.stockfish.send_command("position startpos")
+        self.stockfish.send_command("go depth 8")
+        self.stockfish.starts_with("bestmove")
+        self.stockfish.send_command("save_hash saved.hash")
+        self.stockfish.starts_with("Hash saved successfully")
+        self.stockfish.send_command("setoption name Clear Hash")
+        self.stockfish.send_command("load_hash saved.hash")
+        self.stockfish.starts_with("Hash loaded successfully")
+
     def test_fen_position_mate_1(self):
         self.stockfish.send_command("ucinewgame")
         self.stockfish.send_command(
@@ -398,12 +516,109 @@ class TestInteractive(metaclass=OrderedClassMembers):
         self.stockfish.send_command("go depth 5")
         self.stockfish.starts_with("bestmove")
 
+    def test_verify_mapped_nnue_network(self):
+        current_path = os.path.abspath(os.getcwd())
+        Stockfish(
+            f"export_mapped_net {os.path.join(current_path , 'verify.nnue.map')}".split(" "),
+            True,
+        )
+
+        self.stockfish.send_command("setoption name EvalFile value verify.nnue.map")
+        self.stockfish.send_command("position startpos")
+        self.stockfish.send_command("go depth 5")
+        self.stockfish.starts_with("bestmove")
+
+    def test_hot_swap_nnue_network(self):
+        self.stockfish.send_command("setoption name HotSwapNetworks value true")
+        self.stockfish.send_command("position startpos")
+        self.stockfish.send_command("go infinite")
+        self.stockfish.send_command("setoption name EvalFile value verify.nnue")
+        self.stockfish.expect("info string NNUE networks verify.nnue and * loaded, *")
+        self.stockfish.send_command("stop")
+        self.stockfish.starts_with("bestmove")
+
+        # A file that can't be loaded leaves the networks in use
+        self.stockfish.send_command("setoption name EvalFile value missing.nnue")
+        self.stockfish.expect("info string Failed to load NNUE networks missing.nnue and *")
+        self.stockfish.send_command("go depth 5")
+        self.stockfish.starts_with("bestmove")
+        self.stockfish.send_command("setoption name EvalFile value verify.nnue")
+        self.stockfish.expect("info string NNUE networks verify.nnue and * loaded, *")
+
+        self.stockfish.send_command("setoption name HotSwapNetworks value false")
+        self.stockfish.send_command("go depth 5")
+        self.stockfish.starts_with("bestmove")
+
+    def test_small_net_only(self):
+        self.stockfish.send_command("setoption name SmallNetOnly value true")
+        self.stockfish.send_command("position startpos")
+        self.stockfish.send_command("go depth 5")
+        self.stockfish.starts_with("bestmove")
+        self.stockfish.send_command("setoption name SmallNetOnly value false")
+
+    def test_defer_busy_moves(self):
+        self.stockfish.send_command("setoption name Threads value 4")
+        self.stockfish.send_command("setoption name DeferBusyMoves value true")
+        self.stockfish.send_command("position startpos")
+        self.stockfish.send_command("go depth 12")
+        self.stockfish.starts_with("bestmove")
+        self.stockfish.send_command("setoption name DeferBusyMoves value false")
+        self.stockfish.send_command("setoption name Threads value 1")
+
     def test_multipv_setting(self):
         self.stockfish.send_command("setoption name MultiPV value 4")
         self.stockfish.send_command("position startpos")
         self.stockfish.send_command("go depth 5")
         self.stockfish.starts_with("bestmove")
 
+    def test_split_multipv(self):
+        self.stockfish.send_command("setoption name Threads value 2")
+        self.stockfish.send_command("setoption name MultiPV value 3")
+        self.stockfish.send_command("setoption name SplitMultiPV value true")
+        self.stockfish.send_command("position startpos")
+        self.stockfish.send_command("go depth 9")
+        self.stockfish.starts_with("bestmove")
+        self.stockfish.send_command("setoption name SplitMultiPV value false")
+        self.stockfish.send_command("setoption name MultiPV value 1")
+        self.stockfish.send_command("setoption name Threads value 1")
+
+    def test_deterministic_search(self):
+        self.stockfish.send_command("setoption name Threads value 2")
+        self.stockfish.send_command("setoption name DeterministicSearch value true")
+
+        results = []
+        for _ in range(2):
+            self.stockfish.send_command("ucinewgame")
+            self.stockfish.send_command("position startpos")
+            self.stockfish.clear_output()
+            self.stockfish.send_command("go nodes 40000")
+            self.stockfish.starts_with("bestmove")
+            results.append(
+                [
+                    re.sub(r" (nps|time) \d+", "", line)
+                    for line in self.stockfish.get_output()
+                    if line.startswith(("info depth", "bestmove"))
+                ]
+            )
+
+        assert results[0] == results[1]
+
+        # The threads stop together at the node limit, not at the end of a whole quantum
+        last = [line for line in results[0] if line.startswith("info depth")][-1]
+        assert int(last.split(" nodes ")[1].split()[0]) <= 40000 + 1
+
+        self.stockfish.send_command("setoption name DeterministicSearch value false")
+        self.stockfish.send_command("setoption name Threads value 1")
+
+    def test_shared_histories(self):
+        self.stockfish.send_command("setoption name Threads value 2")
+        self.stockfish.send_command("setoption name SharedHistories value true")
+        self.stockfish.send_command("position startpos")
+        self.stockfish.send_command("go depth 12")
+        self.stockfish.starts_with("bestmove")
+        self.stockfish.send_command("setoption name SharedHistories value false")
+        self.stockfish.send_command("setoption name Threads value 1")
+
     def test_fen_position_with_skill_level(self):
         self.stockfish.send_command("setoption name Skill Level value 10")
         self.stockfish.send_command("position startpos")